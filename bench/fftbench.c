@@ -0,0 +1,374 @@
+/* modspectre.lv2 - fft.c analysis kernel micro-benchmark
+ *
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Time the hot functions of fft.c in isolation for window sizes
+ * 512 .. 65536 and verify their results against double-precision
+ * reference implementations (libfftw3).
+ *
+ * GB/s is the rate at which the kernel consumes its primary input:
+ * window_size floats for window, run and analyze, data_size floats
+ * for the per-bin accessors.
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fft.c"
+
+#define MIN_TIME_NS 50000000ULL /* per kernel and size */
+
+static uint64_t
+clock_ns (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static volatile float sink;
+static int            n_fail = 0;
+
+static void
+report (const char* name, uint32_t size, uint32_t n_bins, uint64_t ns, uint64_t iter, size_t bytes)
+{
+	const double per_call = (double)ns / iter;
+	printf ("%-22s %6u %10.3f %10.3f %9.3f\n",
+	        name, size, per_call * 1e-3, per_call / n_bins, bytes / per_call);
+}
+
+static void
+check (const char* name, uint32_t size, double err, double limit)
+{
+	const bool ok = err <= limit;
+	printf ("  %-20s %6u max-error: %.3g (limit %.3g) %s\n", name, size, err, limit, ok ? "OK" : "FAIL");
+	if (!ok) {
+		++n_fail;
+	}
+}
+
+/* time <code> until MIN_TIME_NS elapsed, set 'ns' and 'iter' */
+#define TIME_IT(CODE)                        \
+	do {                                     \
+		iter         = 0;                    \
+		uint64_t t0_ = clock_ns ();          \
+		do {                                 \
+			for (int k_ = 0; k_ < 8; ++k_) { \
+				CODE;                        \
+			}                                \
+			iter += 8;                       \
+			ns = clock_ns () - t0_;          \
+		} while (ns < MIN_TIME_NS);          \
+	} while (0)
+
+/* *****************************************************************************
+ * reference
+ */
+
+static void
+ref_window (double* w, uint32_t n)
+{
+	double sum = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		w[i] = .5 - .5 * cos (2.0 * M_PI * i / (n - 1.0));
+		sum += w[i];
+	}
+	for (uint32_t i = 0; i < n; ++i) {
+		w[i] *= 2.0 / sum;
+	}
+}
+
+static void
+ref_analyze (const float* in, double* power, double* phase, uint32_t n)
+{
+	double* w   = (double*)fftw_malloc (n * sizeof (double));
+	double* fin = (double*)fftw_malloc (n * sizeof (double));
+	double* out = (double*)fftw_malloc (n * sizeof (double));
+	fftw_plan p = fftw_plan_r2r_1d (n, fin, out, FFTW_R2HC, FFTW_ESTIMATE);
+
+	ref_window (w, n);
+	for (uint32_t i = 0; i < n; ++i) {
+		fin[i] = in[i] * w[i];
+	}
+	fftw_execute (p);
+
+	for (uint32_t i = 1; i < n / 2 - 1; ++i) {
+		power[i] = out[i] * out[i] + out[n - i] * out[n - i];
+		phase[i] = atan2 (out[n - i], out[i]);
+	}
+
+	fftw_destroy_plan (p);
+	fftw_free (w);
+	fftw_free (fin);
+	fftw_free (out);
+}
+
+/* *****************************************************************************
+ * benchmark + verify
+ */
+
+static void
+bench_size (uint32_t n)
+{
+	const double   rate = 48000;
+	const uint32_t hop  = n / 4;
+	const uint32_t nb   = n / 2;
+
+	float*  sig    = (float*)malloc (4 * n * sizeof (float));
+	double* p_ref  = (double*)calloc (nb, sizeof (double));
+	double* ph_ref = (double*)calloc (nb, sizeof (double));
+
+	/* test signal: two sines off bin-center and some noise */
+	const double f0 = rate * (n / 8 + .3) / n;
+	const double f1 = rate * (n / 32 + .71) / n;
+	srand (n);
+	for (uint32_t i = 0; i < 4 * n; ++i) {
+		sig[i] = .5 * sin (2.0 * M_PI * f0 * i / rate) + .25 * sin (2.0 * M_PI * f1 * i / rate) + 1e-3 * (rand () / (double)RAND_MAX - .5);
+	}
+
+	struct FFTAnalysis* ft = (struct FFTAnalysis*)calloc (1, sizeof (struct FFTAnalysis));
+	fftx_init (ft, n, rate, rate / hop);
+	fftx_set_phase (ft, true);
+
+	uint64_t ns, iter;
+
+	/* ft_gen_window (once per size and type, shared) */
+	float* wbuf = (float*)malloc (n * sizeof (float));
+	TIME_IT (ft_gen_window (wbuf, n, W_HANN));
+	report ("ft_gen_window", n, nb, ns, iter, n * sizeof (float));
+	free (wbuf);
+
+	/* _fftx_run, every call produces a frame */
+	uint32_t pos = 0;
+	TIME_IT (fftx_run (ft, hop, &sig[pos]); pos = (pos + hop) % (3 * n));
+	report ("fftx_run", n, nb, ns, iter, n * sizeof (float));
+
+	/* stereo: one batched plan vs. two mono analyzers */
+	{
+		struct FFTAnalysis* st = (struct FFTAnalysis*)calloc (1, sizeof (struct FFTAnalysis));
+		struct FFTAnalysis* m2 = (struct FFTAnalysis*)calloc (1, sizeof (struct FFTAnalysis));
+		fftx_init_multi (st, n, 2, rate, rate / hop);
+		fftx_init (m2, n, rate, rate / hop);
+		float const* ch[2];
+		pos = 0;
+		TIME_IT (ch[0] = &sig[pos]; ch[1] = &sig[(pos + n / 2) % (3 * n)]; fftx_run_multi (st, hop, ch); pos = (pos + hop) % (3 * n));
+		report ("fftx_run_multi (2ch)", n, nb, ns, iter, 2 * n * sizeof (float));
+		pos = 0;
+		TIME_IT (fftx_run (ft, hop, &sig[pos]); fftx_run (m2, hop, &sig[(pos + n / 2) % (3 * n)]); pos = (pos + hop) % (3 * n));
+		report ("2 x fftx_run", n, nb, ns, iter, 2 * n * sizeof (float));
+
+		/* both channels must match a mono analysis of the same input */
+		double err = 0, pk = 0;
+		fftx_reset (st);
+		fftx_reset (m2);
+		fftx_set_step (st, n);
+		fftx_set_step (m2, n);
+		ch[0] = sig;
+		ch[1] = &sig[n];
+		fftx_run_multi (st, n, ch);
+		fftx_run (m2, n, &sig[n]);
+		for (uint32_t i = 0; i < nb; ++i) {
+			err = fmax (err, fabs (FT_POWER (st, 1)[i] - m2->power[i]));
+			pk  = fmax (pk, m2->power[i]);
+		}
+		check ("multi/mono (rel)", n, err / pk, 1e-6);
+		fftx_free (st);
+		fftx_free (m2);
+	}
+
+	/* ft_analyze (FFT + power/phase) */
+	memcpy (ft->fft_in, sig, n * sizeof (float));
+	TIME_IT (ft_analyze (ft));
+	report ("ft_analyze", n, nb, ns, iter, n * sizeof (float));
+
+	/* ft_analyze (FFT + power only) */
+	fftx_set_phase (ft, false);
+	TIME_IT (ft_analyze (ft));
+	report ("ft_analyze (power)", n, nb, ns, iter, n * sizeof (float));
+	fftx_set_phase (ft, true);
+
+	/* power/phase extraction only */
+	TIME_IT (uint32_t i = ft_analyze_simd (ft, 0, 1, nb - 1); ft_analyze_scalar (ft, 0, i, nb - 1));
+	report ("  power+phase (simd)", n, nb, ns, iter, n * sizeof (float));
+	TIME_IT (ft_analyze_scalar (ft, 0, 1, nb - 1));
+	report ("  power+phase (scalar)", n, nb, ns, iter, n * sizeof (float));
+	TIME_IT (uint32_t i = ft_power_simd (ft, 0, 1, nb - 1); ft_power_scalar (ft, 0, i, nb - 1));
+	report ("  power (simd)", n, nb, ns, iter, n * sizeof (float));
+
+	/* per bin accessors */
+	float* dB = (float*)malloc (nb * sizeof (float));
+	TIME_IT (for (uint32_t i = 1; i < nb - 1; ++i) { sink = fftx_power_at_bin (ft, i); });
+	report ("fftx_power_at_bin", n, nb, ns, iter, nb * sizeof (float));
+	TIME_IT (fftx_power_to_dB_n (dB, ft->power, nb - 1));
+	report ("fftx_power_to_dB_n", n, nb, ns, iter, nb * sizeof (float));
+	TIME_IT (for (uint32_t i = 1; i < nb - 1; ++i) { sink = fftx_freq_at_bin (ft, i); });
+	report ("fftx_freq_at_bin", n, nb, ns, iter, 2 * nb * sizeof (float));
+
+	/* verify window */
+	{
+		double* w = (double*)malloc (n * sizeof (double));
+		ref_window (w, n);
+		float const* window = ft->window;
+		double       err    = 0;
+		for (uint32_t i = 0; i < n; ++i) {
+			err = fmax (err, fabs (window[i] - w[i]) / (2.0 / n));
+		}
+		check ("window (rel)", n, err, 1e-5);
+		free (w);
+	}
+
+	/* verify power, phase and dB against double precision, bins within 80dB of peak */
+	{
+		memcpy (ft->fft_in, sig, n * sizeof (float));
+		float const* window = ft->window;
+		for (uint32_t i = 0; i < n; ++i) {
+			ft->fft_in[i] *= window[i];
+		}
+		ft_analyze (ft);
+		ref_analyze (sig, p_ref, ph_ref, n);
+
+		double pk = 0;
+		for (uint32_t i = 1; i < nb - 1; ++i) {
+			pk = fmax (pk, p_ref[i]);
+		}
+
+		double e_db = 0, e_ph = 0, e_dbn = 0, e_dbs = 0, e_simd = 0;
+		fftx_power_to_dB_n (dB, ft->power, nb - 1);
+		for (uint32_t i = 1; i < nb - 1; ++i) {
+			if (p_ref[i] < pk * 1e-8) {
+				continue;
+			}
+			e_db = fmax (e_db, fabs (10.0 * log10 (ft->power[i]) - 10.0 * log10 (p_ref[i])));
+			e_dbn = fmax (e_dbn, fabs (dB[i] - 10.0 * log10 (p_ref[i])));
+			e_dbs = fmax (e_dbs, fabs (dB[i] - fftx_power_to_dB (ft->power[i])));
+			double d = fabs (ft->phase[i] - ph_ref[i]);
+			if (d > M_PI) {
+				d = 2 * M_PI - d;
+			}
+			e_ph = fmax (e_ph, d);
+		}
+
+		/* SIMD vs scalar reference on identical FFT output */
+		float* pw = (float*)malloc (nb * sizeof (float));
+		float* ph = (float*)malloc (nb * sizeof (float));
+		memcpy (pw, ft->power, nb * sizeof (float));
+		memcpy (ph, ft->phase, nb * sizeof (float));
+		ft_analyze_scalar (ft, 0, 1, nb - 1);
+		for (uint32_t i = 1; i < nb - 1; ++i) {
+			double d = fabs (ph[i] - ft->phase[i]);
+			if (d > M_PI) {
+				d = 2 * M_PI - d;
+			}
+			e_simd = fmax (e_simd, d);
+			if (pw[i] != ft->power[i]) {
+				e_simd = INFINITY;
+			}
+		}
+		/* power only */
+		uint32_t k = ft_power_simd (ft, 0, 1, nb - 1);
+		ft_power_scalar (ft, 0, k, nb - 1);
+		for (uint32_t i = 1; i < nb - 1; ++i) {
+			if (pw[i] != ft->power[i]) {
+				e_simd = INFINITY;
+			}
+		}
+		/* signed zeros, atan2f (y, -0) is +-pi */
+		{
+			const float  re[8] = { -0.f, -0.f, -0.f, -0.f, 0.f, 0.f, -0.f, -1.f };
+			const float  im[8] = { 0.f, -0.f, 1.f, -1.f, 0.f, -0.f, 1e-30f, -0.f };
+			float* const fo    = FT_OUT (ft, 0);
+			for (uint32_t i = 0; i < 8; ++i) {
+				fo[1 + i] = re[i];
+				fo[n - 1 - i] = im[i];
+			}
+			k = ft_analyze_simd (ft, 0, 1, 9);
+			ft_analyze_scalar (ft, 0, k, 9);
+			memcpy (ph, ft->phase, nb * sizeof (float));
+			ft_analyze_scalar (ft, 0, 1, 9);
+			for (uint32_t i = 1; i < 9; ++i) {
+				double d = fabs (ph[i] - ft->phase[i]);
+				if (d > M_PI) {
+					d = 2 * M_PI - d;
+				}
+				e_simd = fmax (e_simd, d);
+			}
+		}
+		free (pw);
+		free (ph);
+
+		check ("power [dB]", n, e_db, 1e-2);
+		/* fast_log2() is a 2nd order approximation, < 0.3 dB */
+		check ("power_to_dB_n [dB]", n, e_dbn, 0.3);
+		check ("dB_n/power_to_dB [dB]", n, e_dbs, 1e-4);
+		check ("phase [rad]", n, e_ph, 2e-3);
+		check ("simd/scalar [rad]", n, e_simd, 2e-5);
+	}
+
+	/* verify phase-vocoder frequency of the peak bin, 87.5% .. 12.5% overlap */
+	for (uint32_t h = n / 8; h < n; h += n / 4) {
+		char name[32];
+		fftx_reset (ft);
+		fftx_set_step (ft, h);
+		for (uint32_t i = 0; i + h <= 4 * n; i += h) {
+			fftx_run (ft, h, &sig[i]);
+		}
+		uint32_t b = 0;
+		for (uint32_t i = 1; i < nb - 1; ++i) {
+			if (ft->power[i] > ft->power[b]) {
+				b = i;
+			}
+		}
+		snprintf (name, sizeof (name), "freq_at_bin/%.3f", h / (double)n);
+		check (name, n, fabs (fftx_freq_at_bin (ft, b) - f0) / ft->freq_per_bin, 1e-2);
+	}
+
+	fftx_free (ft);
+	free (dB);
+	free (sig);
+	free (p_ref);
+	free (ph_ref);
+}
+
+int
+main (int argc, char** argv)
+{
+#if defined __AVX2__ && !defined FFTX_NO_SIMD
+	printf ("# SIMD: AVX2\n");
+#elif defined __SSE2__ && !defined FFTX_NO_SIMD
+	printf ("# SIMD: SSE2\n");
+#else
+	printf ("# SIMD: none\n");
+#endif
+	printf ("# kernel                 size   us/call    ns/bin      GB/s\n");
+
+	for (uint32_t n = 512; n <= 65536; n *= 2) {
+		bench_size (n);
+	}
+
+	if (n_fail) {
+		printf ("%d check(s) failed\n", n_fail);
+		return 1;
+	}
+	return 0;
+}
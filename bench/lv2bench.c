@@ -0,0 +1,648 @@
+/* modspectre.lv2 - headless host simulation benchmark
+ *
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Load the plugin binary via dlopen/lv2_descriptor() and drive run()
+ * of N concurrent instances with synthetic signals, the same way a
+ * host would. Reports run() latency percentiles, DSP load, CPU time
+ * used by the plugin's background threads and frames per second
+ * delivered on the notify port.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lv2/lv2plug.in/ns/lv2core/lv2.h>
+#include <lv2/lv2plug.in/ns/ext/atom/atom.h>
+#include <lv2/lv2plug.in/ns/ext/atom/util.h>
+#include <lv2/lv2plug.in/ns/ext/urid/urid.h>
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
+
+#define MAX_BLOCK   8192
+#define MAX_PORTS   64
+#define NOTIFY_SIZE 65536
+#define N_STATS     5 // instrumentation output ports, if built with stats
+#define WQ_SIZE     4096 // host worker request queue
+
+enum {
+	SIG_SWEEP = 0,
+	SIG_NOISE,
+	SIG_SILENCE,
+	SIG_LAST
+};
+
+static const char* sig_names[SIG_LAST] = { "sweep", "noise", "silence" };
+
+/* *****************************************************************************
+ * URID map
+ */
+
+static pthread_mutex_t urid_lock = PTHREAD_MUTEX_INITIALIZER;
+static char**          urid_uris = NULL;
+static uint32_t        urid_n    = 0;
+
+static LV2_URID
+urid_map (LV2_URID_Map_Handle handle, const char* uri)
+{
+	pthread_mutex_lock (&urid_lock);
+	for (uint32_t i = 0; i < urid_n; ++i) {
+		if (!strcmp (urid_uris[i], uri)) {
+			pthread_mutex_unlock (&urid_lock);
+			return i + 1;
+		}
+	}
+	urid_uris = (char**)realloc (urid_uris, (urid_n + 1) * sizeof (char*));
+	urid_uris[urid_n] = strdup (uri);
+	LV2_URID rv = ++urid_n;
+	pthread_mutex_unlock (&urid_lock);
+	return rv;
+}
+
+static void
+urid_free (void)
+{
+	for (uint32_t i = 0; i < urid_n; ++i) {
+		free (urid_uris[i]);
+	}
+	free (urid_uris);
+	urid_uris = NULL;
+	urid_n    = 0;
+}
+
+/* *****************************************************************************
+ * helpers
+ */
+
+static uint64_t
+clock_ns (clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime (id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+cmp_u64 (const void* a, const void* b)
+{
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t rnd_state = 2463534242U;
+
+static float
+rnd_white (void)
+{
+	/* xorshift32 */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return (rnd_state / 2147483648.f) - 1.f;
+}
+
+static void
+gen_signal (int sig, float* buf, uint32_t n, double rate, uint64_t pos, uint64_t len, double* phase)
+{
+	switch (sig) {
+		case SIG_SWEEP:
+			/* exponential sweep 20Hz .. 20kHz over the whole run */
+			for (uint32_t i = 0; i < n; ++i) {
+				const double f = 20.0 * pow (1000.0, (double)(pos + i) / len);
+				*phase += 2.0 * M_PI * f / rate;
+				buf[i] = .5f * sinf (*phase);
+			}
+			*phase = fmod (*phase, 2.0 * M_PI);
+			break;
+		case SIG_NOISE:
+			for (uint32_t i = 0; i < n; ++i) {
+				buf[i] = .5f * rnd_white ();
+			}
+			break;
+		default:
+			memset (buf, 0, n * sizeof (float));
+			break;
+	}
+}
+
+static int
+parse_list (const char* arg, double* list, int max)
+{
+	int   n   = 0;
+	char* tmp = strdup (arg);
+	char* sp  = NULL;
+	for (char* t = strtok_r (tmp, ",", &sp); t && n < max; t = strtok_r (NULL, ",", &sp)) {
+		list[n++] = atof (t);
+	}
+	free (tmp);
+	return n;
+}
+
+/* *****************************************************************************
+ * benchmark
+ */
+
+typedef struct {
+	LV2_Handle handle;
+	uint8_t*   notify;
+	uint64_t   n_events;
+	float      stats[N_STATS];
+
+	/* host worker */
+	LV2_Worker_Schedule sched;
+	LV2_Feature         sched_feat;
+	const LV2_Feature*  features[8];
+	volatile uint32_t   n_resp; // pending (empty) responses
+} Instance;
+
+/* *****************************************************************************
+ * host worker (-W): a single non-realtime thread shared by all
+ * instances, as provided by many hosts. Requests are queued, responses
+ * are delivered after run(). Only empty messages are supported, which
+ * is all the plugin uses.
+ */
+
+static struct {
+	pthread_mutex_t            lock;
+	pthread_cond_t             cond;
+	pthread_t                  thread;
+	Instance*                  queue[WQ_SIZE];
+	uint32_t                   n_queued;
+	uint32_t                   head;
+	bool                       busy;
+	bool                       run;
+	const LV2_Worker_Interface* iface;
+} hw = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+static LV2_Worker_Status
+hw_schedule (LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+	LV2_Worker_Status rv = LV2_WORKER_ERR_NO_SPACE;
+	pthread_mutex_lock (&hw.lock);
+	if (size == 0 && hw.n_queued < WQ_SIZE) {
+		hw.queue[(hw.head + hw.n_queued++) % WQ_SIZE] = (Instance*)handle;
+		pthread_cond_broadcast (&hw.cond);
+		rv = LV2_WORKER_SUCCESS;
+	}
+	pthread_mutex_unlock (&hw.lock);
+	return rv;
+}
+
+static LV2_Worker_Status
+hw_respond (LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+	if (size > 0) {
+		return LV2_WORKER_ERR_NO_SPACE;
+	}
+	__sync_fetch_and_add (&((Instance*)handle)->n_resp, 1);
+	return LV2_WORKER_SUCCESS;
+}
+
+static void*
+hw_thread (void* arg)
+{
+	pthread_mutex_lock (&hw.lock);
+	while (hw.run) {
+		if (hw.n_queued == 0) {
+			pthread_cond_wait (&hw.cond, &hw.lock);
+			continue;
+		}
+		Instance* inst = hw.queue[hw.head];
+		hw.head        = (hw.head + 1) % WQ_SIZE;
+		--hw.n_queued;
+		hw.busy = true;
+		pthread_mutex_unlock (&hw.lock);
+
+		hw.iface->work (inst->handle, hw_respond, inst, 0, NULL);
+
+		pthread_mutex_lock (&hw.lock);
+		hw.busy = false;
+		pthread_cond_broadcast (&hw.cond);
+	}
+	pthread_mutex_unlock (&hw.lock);
+	return NULL;
+}
+
+/* wait until all requests are processed */
+static void
+hw_sync (void)
+{
+	pthread_mutex_lock (&hw.lock);
+	while (hw.n_queued > 0 || hw.busy) {
+		pthread_cond_wait (&hw.cond, &hw.lock);
+	}
+	pthread_mutex_unlock (&hw.lock);
+}
+
+static void
+hw_deliver (Instance* inst)
+{
+	while (inst->n_resp > 0) {
+		__sync_fetch_and_sub (&inst->n_resp, 1);
+		hw.iface->work_response (inst->handle, 0, NULL);
+	}
+	if (hw.iface->end_run) {
+		hw.iface->end_run (inst->handle);
+	}
+}
+
+typedef struct {
+	const LV2_Descriptor* desc;
+	const LV2_Feature**   features;
+	float*                ctrl;
+	uint32_t              n_ctrl;
+	uint32_t              n_audio; // audio inputs, 1: mono (port 0)
+	double                duration;
+	bool                  freewheel;
+	bool                  stats;   // print instrumentation ports
+	bool                  worker;  // provide work:schedule
+	LV2_URID              stats_urid;
+} Config;
+
+/* true if the sequence contains anything but stats messages */
+static bool
+has_frame (Config const* cfg, LV2_Atom_Sequence const* seq)
+{
+	LV2_ATOM_SEQUENCE_FOREACH (seq, ev) {
+		LV2_Atom_Object const* obj = (LV2_Atom_Object const*)&ev->body;
+		if (obj->body.otype != cfg->stats_urid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+bench (Config* cfg, double rate, uint32_t block, uint32_t n_inst, int sig)
+{
+	const LV2_Descriptor* d = cfg->desc;
+
+	Instance* inst = (Instance*)calloc (n_inst, sizeof (Instance));
+	float*    a_in = (float*)calloc (MAX_BLOCK, sizeof (float));
+
+	for (uint32_t i = 0; i < n_inst; ++i) {
+		const LV2_Feature** features = cfg->features;
+		if (cfg->worker) {
+			uint32_t f = 0;
+			for (; cfg->features[f] && f < 6; ++f) {
+				inst[i].features[f] = cfg->features[f];
+			}
+			inst[i].sched.handle       = &inst[i];
+			inst[i].sched.schedule_work = hw_schedule;
+			inst[i].sched_feat.URI     = LV2_WORKER__schedule;
+			inst[i].sched_feat.data    = &inst[i].sched;
+			inst[i].features[f++]      = &inst[i].sched_feat;
+			inst[i].features[f]        = NULL;
+			features                   = inst[i].features;
+		}
+		inst[i].handle = d->instantiate (d, rate, ".", features);
+		if (!inst[i].handle) {
+			fprintf (stderr, "Failed to instantiate plugin (#%d)\n", i);
+			n_inst = i;
+			break;
+		}
+		inst[i].notify = (uint8_t*)malloc (NOTIFY_SIZE);
+		d->connect_port (inst[i].handle, 0, a_in);
+		d->connect_port (inst[i].handle, 2, inst[i].notify);
+		/* multichannel variants: additional inputs follow the
+		 * mono ports, all channels get the same signal */
+		for (uint32_t p = 10; p < 9 + cfg->n_audio; ++p) {
+			d->connect_port (inst[i].handle, p, a_in);
+		}
+		for (uint32_t p = 1; p < cfg->n_ctrl; ++p) {
+			if (p != 2 && (p < 10 || p >= 9 + cfg->n_audio)) {
+				d->connect_port (inst[i].handle, p, &cfg->ctrl[p]);
+			}
+		}
+		/* instrumentation ports follow the mono ports, or the multichannel toggles */
+		const uint32_t ps = cfg->n_audio > 1 ? 11 + cfg->n_audio : 10;
+		for (uint32_t p = 0; p < N_STATS; ++p) {
+			d->connect_port (inst[i].handle, ps + p, &inst[i].stats[p]);
+		}
+		if (d->activate) {
+			d->activate (inst[i].handle);
+		}
+	}
+
+	if (n_inst == 0) {
+		free (a_in);
+		free (inst);
+		return -1;
+	}
+
+	const uint64_t n_total  = cfg->duration * rate;
+	const uint64_t n_cycles = (n_total + block - 1) / block;
+	const uint64_t n_lat    = n_cycles * n_inst;
+	uint64_t*      lat      = (uint64_t*)malloc (n_lat * sizeof (uint64_t));
+	uint64_t       n_meas   = 0;
+	double         phase    = 0;
+
+	const double   cycle_ns = 1e9 * block / rate;
+	const uint64_t t_start  = clock_ns (CLOCK_MONOTONIC);
+	const uint64_t c_proc   = clock_ns (CLOCK_PROCESS_CPUTIME_ID);
+	const uint64_t c_main   = clock_ns (CLOCK_THREAD_CPUTIME_ID);
+	uint64_t       t_dsp    = 0;
+
+	for (uint64_t c = 0; c < n_cycles; ++c) {
+		gen_signal (sig, a_in, block, rate, c * block, n_total, &phase);
+
+		for (uint32_t i = 0; i < n_inst; ++i) {
+			LV2_Atom_Sequence* seq = (LV2_Atom_Sequence*)inst[i].notify;
+			seq->atom.size         = NOTIFY_SIZE - sizeof (LV2_Atom);
+			seq->atom.type         = 0;
+
+			const uint64_t t0 = clock_ns (CLOCK_MONOTONIC);
+			d->run (inst[i].handle, block);
+			if (hw.iface) {
+				hw_deliver (&inst[i]);
+			}
+			const uint64_t dt = clock_ns (CLOCK_MONOTONIC) - t0;
+
+			lat[n_meas++] = dt;
+			t_dsp += dt;
+
+			/* one frame may consist of several events */
+			if (seq->atom.size > sizeof (LV2_Atom_Sequence_Body) && has_frame (cfg, seq)) {
+				++inst[i].n_events;
+			}
+		}
+
+		if (!cfg->freewheel) {
+			const uint64_t  deadline = t_start + (c + 1) * cycle_ns;
+			struct timespec ts       = { deadline / 1000000000ULL, deadline % 1000000000ULL };
+			clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+	}
+
+	const double t_wall  = (clock_ns (CLOCK_MONOTONIC) - t_start) * 1e-9;
+	const double c_total = (clock_ns (CLOCK_PROCESS_CPUTIME_ID) - c_proc) * 1e-9;
+	const double c_run   = (clock_ns (CLOCK_THREAD_CPUTIME_ID) - c_main) * 1e-9;
+	const double c_bg    = c_total > c_run ? c_total - c_run : 0;
+
+	if (hw.iface) {
+		hw_sync ();
+	}
+
+	uint64_t n_events = 0;
+	float    stats[N_STATS] = { 0 };
+	for (uint32_t i = 0; i < n_inst; ++i) {
+		n_events += inst[i].n_events;
+		for (uint32_t p = 0; p < N_STATS; ++p) {
+			stats[p] += inst[i].stats[p] / n_inst;
+		}
+		d->cleanup (inst[i].handle);
+		free (inst[i].notify);
+	}
+
+	qsort (lat, n_meas, sizeof (uint64_t), cmp_u64);
+
+	const double audio_time = (double)n_cycles * block / rate;
+	printf ("%7.0f %6u %5u %-8s %9.2f %9.2f %9.2f %8.2f %10.2f %11.1f\n",
+	        rate, block, n_inst, sig_names[sig],
+	        lat[n_meas / 2] * 1e-3,
+	        lat[(uint64_t)(n_meas * .99)] * 1e-3,
+	        lat[n_meas - 1] * 1e-3,
+	        100.0 * t_dsp * 1e-9 / audio_time,
+	        100.0 * c_bg / t_wall,
+	        n_events / audio_time);
+	if (cfg->stats) {
+		printf ("# stats (mean of all instances, last second): %.1f fps, latency %.2f ms, analysis %.3f ms, load %.2f%%, skipped %.1f%%\n",
+		        stats[0], stats[1], stats[2], stats[3], stats[4]);
+	}
+	fflush (stdout);
+
+	free (lat);
+	free (a_in);
+	free (inst);
+	return 0;
+}
+
+static void
+usage (void)
+{
+	printf ("lv2bench - modspectre.lv2 host simulation benchmark\n\n"
+	        "Usage: lv2bench [ OPTIONS ] [ plugin.so ]\n\n"
+	        "Options:\n"
+	        "  -b <list>   comma separated block sizes (default 16,64,256,1024,8192)\n"
+	        "  -c <p>=<v>  set control port <p> to value <v>\n"
+	        "  -d <sec>    audio duration per run (default 1)\n"
+	        "  -F          freewheel, call run() as fast as possible (default: realtime)\n"
+	        "  -h          print this message\n"
+	        "  -i <idx>    plugin descriptor index (default 0: mono)\n"
+	        "              1: stereo, 2: 4 channels, 3: 8 channels\n"
+	        "  -n <list>   comma separated instance counts (default 1,16,64,256)\n"
+	        "  -r <list>   comma separated sample rates (default 44100,48000,96000)\n"
+	        "  -s <sig>    sweep, noise, silence or all (default all)\n"
+	        "  -S          print the plugin's instrumentation ports (if built with stats)\n"
+	        "  -W          provide a host worker (LV2 work:schedule), one thread\n"
+	        "              for all instances, instead of the plugin's thread-pool\n"
+	        "\n"
+	        "In realtime mode each cycle is paced to the duration of one block.\n"
+	        "Columns: run() latency percentiles [us], DSP load [%%] of run() calls\n"
+	        "relative to audio time, CPU [%%] used by all other threads (analysis\n"
+	        "workers) relative to wall-clock time, and notify frames per second\n"
+	        "summed over all instances.\n"
+	        "\n"
+	        "Multichannel variants: ports 10 .. 8 + <channels> are audio inputs,\n"
+	        "followed by the mid/side and correlation toggles (-c <p>=1).\n");
+}
+
+int
+main (int argc, char** argv)
+{
+	double rates[16]  = { 44100, 48000, 96000 };
+	double blocks[16] = { 16, 64, 256, 1024, 8192 };
+	double insts[16]  = { 1, 16, 64, 256 };
+	int    n_rates    = 3;
+	int    n_blocks   = 5;
+	int    n_insts    = 4;
+	int    sig        = -1;
+	int    index      = 0;
+
+	float ctrl[MAX_PORTS];
+	for (int i = 0; i < MAX_PORTS; ++i) {
+		ctrl[i] = 0;
+	}
+	ctrl[1] = 1.0; // response
+	ctrl[3] = 1.0; // bin-mapping: peak
+	ctrl[4] = 4096; // FFT size
+	ctrl[5] = 256; // display columns
+	ctrl[6] = 0; // encoding: float
+	ctrl[7] = 30; // analysis rate [fps]
+	ctrl[8] = 0; // min. overlap
+	ctrl[9] = 0; // engine: FFT
+
+	Config cfg;
+	memset (&cfg, 0, sizeof (cfg));
+	cfg.duration = 1.0;
+	cfg.ctrl     = ctrl;
+	cfg.n_ctrl   = 10;
+	cfg.n_audio  = 1;
+
+	int c;
+	while ((c = getopt (argc, argv, "b:c:d:Fhi:n:r:s:SW")) != -1) {
+		switch (c) {
+			case 'b':
+				n_blocks = parse_list (optarg, blocks, 16);
+				break;
+			case 'c': {
+				int   p = atoi (optarg);
+				char* v = strchr (optarg, '=');
+				if (p > 0 && p < MAX_PORTS && v) {
+					ctrl[p] = atof (v + 1);
+					if (p >= (int)cfg.n_ctrl) {
+						cfg.n_ctrl = p + 1;
+					}
+				}
+			} break;
+			case 'd':
+				cfg.duration = atof (optarg);
+				break;
+			case 'F':
+				cfg.freewheel = true;
+				break;
+			case 'h':
+				usage ();
+				return 0;
+			case 'i':
+				index = atoi (optarg);
+				break;
+			case 'n':
+				n_insts = parse_list (optarg, insts, 16);
+				break;
+			case 'r':
+				n_rates = parse_list (optarg, rates, 16);
+				break;
+			case 'S':
+				cfg.stats = true;
+				break;
+			case 'W':
+				cfg.worker = true;
+				break;
+			case 's':
+				sig = -1;
+				for (int s = 0; s < SIG_LAST; ++s) {
+					if (!strcmp (optarg, sig_names[s])) {
+						sig = s;
+					}
+				}
+				break;
+			default:
+				usage ();
+				return 1;
+		}
+	}
+
+	const char* path = optind < argc ? argv[optind] : "build/modspectre.so";
+
+	void* lib = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		fprintf (stderr, "Cannot open plugin: %s\n", dlerror ());
+		return 1;
+	}
+
+	LV2_Descriptor_Function df = (LV2_Descriptor_Function)dlsym (lib, "lv2_descriptor");
+	if (!df || !(cfg.desc = df (index))) {
+		fprintf (stderr, "Plugin does not provide an LV2 descriptor\n");
+		dlclose (lib);
+		return 1;
+	}
+
+	LV2_URID_Map       map      = { NULL, urid_map };
+	LV2_Feature        map_feat = { LV2_URID__map, &map };
+	const LV2_Feature* features[] = { &map_feat, NULL };
+	cfg.features   = features;
+	cfg.stats_urid = urid_map (NULL, "http://gareus.org/oss/lv2/modspectre#stats");
+
+	/* see lv2_descriptor () */
+	const uint32_t n_audio[] = { 1, 2, 4, 8 };
+	cfg.n_audio = (index > 0 && index < 4) ? n_audio[index] : 1;
+	if (cfg.n_audio > 1) {
+		/* mid/side and correlation toggles */
+		for (uint32_t p = 9 + cfg.n_audio; p < 11 + cfg.n_audio; ++p) {
+			if (p >= cfg.n_ctrl) {
+				cfg.n_ctrl = p + 1;
+			}
+		}
+	}
+
+	if (cfg.worker) {
+		if (!cfg.desc->extension_data
+		    || !(hw.iface = (const LV2_Worker_Interface*)cfg.desc->extension_data (LV2_WORKER__interface))) {
+			fprintf (stderr, "Plugin does not provide a worker interface\n");
+			dlclose (lib);
+			return 1;
+		}
+		hw.run = true;
+		if (pthread_create (&hw.thread, NULL, hw_thread, NULL)) {
+			fprintf (stderr, "Cannot start worker thread\n");
+			dlclose (lib);
+			return 1;
+		}
+	}
+
+	printf ("# %s%s\n", cfg.desc->URI, cfg.worker ? " (host worker)" : "");
+	printf ("#  rate  block  inst signal   p50[us]   p99[us]   max[us]  dsp[%%] worker[%%]    frames/s\n");
+
+	for (int r = 0; r < n_rates; ++r) {
+		for (int b = 0; b < n_blocks; ++b) {
+			if (blocks[b] < 1 || blocks[b] > MAX_BLOCK) {
+				continue;
+			}
+			for (int n = 0; n < n_insts; ++n) {
+				for (int s = 0; s < SIG_LAST; ++s) {
+					if (sig >= 0 && s != sig) {
+						continue;
+					}
+					bench (&cfg, rates[r], blocks[b], insts[n], s);
+				}
+			}
+		}
+	}
+
+	struct rusage ru;
+	if (0 == getrusage (RUSAGE_SELF, &ru)) {
+		printf ("# max. RSS: %ld KiB\n", ru.ru_maxrss);
+	}
+
+	if (cfg.worker) {
+		pthread_mutex_lock (&hw.lock);
+		hw.run = false;
+		pthread_cond_broadcast (&hw.cond);
+		pthread_mutex_unlock (&hw.lock);
+		pthread_join (hw.thread, NULL);
+	}
+
+	dlclose (lib);
+	urid_free ();
+	return 0;
+}
@@ -26,6 +26,46 @@ function (event) {
 		return y_pos(1 + db / 96);
 	}
 
+	/* decode compact 'bin_code' frames, see src/bincode.c */
+	function decode_frame (ds, code) {
+		var hdr    = code[0] >>> 0;
+		var n_bins = hdr >>> 16;
+		var bits   = (hdr >>> 8) & 0xff;
+		var per    = 32 / bits;
+		var qmax   = bits == 16 ? 0xffff : 0xff;
+		var bins   = ds['http://gareus.org/oss/lv2/modspectre#bin_data'];
+
+		if (hdr & 1) {
+			/* keyframe */
+			bins = new Array (n_bins);
+			for (var b = 0; b < n_bins; b++) {
+				bins[b] = 0;
+			}
+		} else if (bins === undefined || bins.length !== n_bins) {
+			/* delta, wait for next keyframe */
+			return false;
+		}
+
+		var i = 1;
+		while (i < code.length) {
+			var range = code[i++] >>> 0;
+			var start = range >>> 16;
+			var count = range & 0xffff;
+			if (start + count > n_bins) {
+				return false;
+			}
+			for (var k = 0; k < count; k++) {
+				var word = code[i + Math.floor (k / per)] >>> 0;
+				bins[start + k] = ((word >>> ((k % per) * bits)) & qmax) / qmax;
+			}
+			i += Math.ceil (count / per);
+		}
+
+		ds['http://gareus.org/oss/lv2/modspectre#bin_count'] = n_bins;
+		ds['http://gareus.org/oss/lv2/modspectre#bin_data'] = bins;
+		return true;
+	}
+
 	/* the actual SVG drawing function */
 	function x42_draw_spectrum (sd) {
 		var ds = sd.data ('xModPorts');
@@ -90,10 +130,14 @@ function (event) {
 			return;
 		}
 
+		/* display columns may differ from the display width */
+		var n_bins = bins.length;
+		var xscale = width / n_bins;
+
 		var path = [];
 		g = svg.group ({stroke: color, strokeWidth: 1.0, fill: 'none'});
-		for (var x = 0; x < width; x++) {
-			path.push ([x, y_pos (bins[x])]);
+		for (var b = 0; b < n_bins; b++) {
+			path.push ([b * xscale, y_pos (bins[b])]);
 		}
 		svg.polyline (g, path, {clipPath: 'url(#tfClip)'});
 		path.push ([width + 1, height]);
@@ -127,8 +171,19 @@ function (event) {
 	} else if (event.type == 'change') {
 		var sd = event.icon.find ('[mod-role=spectrum-display]');
 		var ds = sd.data ('xModPorts');
-		if (event.uri) {
-			if (event.value.length !== 256) {
+		if (event.uri == 'http://gareus.org/oss/lv2/modspectre#bin_code') {
+			if (!decode_frame (ds, event.value)) {
+				return;
+			}
+		} else if (event.uri == 'http://gareus.org/oss/lv2/modspectre#bin_count') {
+			ds[event.uri] = event.value;
+			return;
+		} else if (event.uri) {
+			var n_bins = ds['http://gareus.org/oss/lv2/modspectre#bin_count'];
+			if (n_bins === undefined) {
+				n_bins = 256;
+			}
+			if (event.value.length !== n_bins) {
 				console.log("modspectre: Invalid data")
 				return
 			}
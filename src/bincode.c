@@ -0,0 +1,116 @@
+/* compact spectrum frame encoding
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Display columns (0..1) are quantized to 8 or 16 bit and packed into
+ * a vector of 32bit integers:
+ *
+ *   [0]  header: n_cols << 16 | bits << 8 | flags (BC_KEYFRAME)
+ *   then for every range of columns:
+ *        start << 16 | count
+ *        ceil (count * bits / 32) words, first column in the LSB
+ *
+ * A keyframe is a single range that covers all columns, a delta frame
+ * only contains ranges of columns that changed since the previous frame.
+ *
+ * See modgui/script-modspectre.js for the matching decoder.
+ */
+
+typedef enum {
+	BC_FLOAT = 0, /* uncompressed float vector */
+	BC_16BIT,
+	BC_8BIT,
+} bincode_t;
+
+#define BC_KEYFRAME 1
+
+/* max. size of an encoded frame in 32bit words */
+#define BC_WORDS(N_COLS) (2 + ((N_COLS) + 1) / 2)
+
+static int
+bc_bits (bincode_t enc)
+{
+	return enc == BC_8BIT ? 8 : 16;
+}
+
+/* encode columns [c0, c0 + n) at out[0], returns number of words used */
+static uint32_t
+bc_range (int32_t* out, float const* val, uint32_t c0, uint32_t n, int bits)
+{
+	const uint32_t per  = 32 / bits;
+	const float    qmax = (1 << bits) - 1;
+	uint32_t       w    = 0;
+
+	out[w++] = (c0 << 16) | n;
+
+	for (uint32_t i = 0; i < n; i += per) {
+		uint32_t word = 0;
+		for (uint32_t k = 0; k < per && i + k < n; ++k) {
+			float v = val[c0 + i + k];
+			v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+			word |= (uint32_t)lrintf (v * qmax) << (k * bits);
+		}
+		out[w++] = (int32_t)word;
+	}
+	return w;
+}
+
+/* encode a keyframe (changed == NULL) or delta frame.
+ * returns the number of words used, or 0 if the frame exceeds 'capacity'
+ */
+static uint32_t
+bc_encode (int32_t* out, uint32_t capacity, float const* val, bool const* changed, uint32_t n_cols, bincode_t enc)
+{
+	const int      bits = bc_bits (enc);
+	const uint32_t gap  = 32 / bits; // columns per word, same cost as a range header
+	uint32_t       w    = 1;
+
+	if (capacity < BC_WORDS (n_cols)) {
+		return 0;
+	}
+
+	out[0] = (n_cols << 16) | (bits << 8) | (changed ? 0 : BC_KEYFRAME);
+
+	if (!changed) {
+		return w + bc_range (&out[w], val, 0, n_cols, bits);
+	}
+
+	uint32_t c = 0;
+	while (c < n_cols) {
+		if (!changed[c]) {
+			++c;
+			continue;
+		}
+		/* extend range, bridge short runs of unchanged columns */
+		uint32_t e = c + 1;
+		uint32_t u = 0;
+		for (uint32_t i = e; i < n_cols && u <= gap; ++i) {
+			if (changed[i]) {
+				e = i + 1;
+				u = 0;
+			} else {
+				++u;
+			}
+		}
+		if (w + 1 + (e - c + gap - 1) / gap > capacity) {
+			return 0;
+		}
+		w += bc_range (&out[w], val, c, e - c, bits);
+		c = e;
+	}
+	return w;
+}
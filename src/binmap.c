@@ -0,0 +1,303 @@
+/* FFT bin to display column mapping
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Precomputed sparse (CSR) mapping of FFT bins to log-scaled display
+ * columns (20Hz .. 20kHz). The table only depends on sample-rate,
+ * FFT size (or bin frequencies), column count and mode. It is rebuilt when one of those
+ * changes, so mapping a frame does not need any per-bin transcendental
+ * math: only one log per display column.
+ *
+ * Requires fft.c (fftx_power_to_dB_n) to be included first.
+ */
+
+typedef enum {
+	BM_PEAK = 0, /* max of all bins in a column */
+	BM_POWER,    /* sum of power of all bins in a column */
+	BM_OCT6,     /* 1/6 octave smoothing (average power) */
+	BM_OCT3,     /* 1/3 octave smoothing (average power) */
+} binmap_t;
+
+struct BinMap {
+	binmap_t mode;
+	uint32_t n_cols;
+	uint32_t n_bins;
+	double   freq_per_bin;
+	float const* bin_freq; /* [n_bins] ascending, NULL: uniform i * freq_per_bin */
+	uint32_t i_min, i_max; /* usable bins [i_min, i_max) */
+
+	uint32_t* col_ptr; /* [n_cols + 1] start of each column in bin_idx, weight */
+	uint32_t* bin_idx; /* [nnz] FFT bin */
+	float*    weight;  /* [nnz] */
+	bool*     sum;     /* [n_cols] weighted sum (interpolated, smoothed) instead of max */
+	float*    col_pwr; /* [n_cols] scratch */
+	uint32_t  capacity;
+	uint32_t  max_cols;
+};
+
+static const float bm_log1k = 6.907755279f; // logf (1000);
+
+static int
+bm_col_at_freq (uint32_t n_cols, float f)
+{
+	return n_cols * logf (f / 20.0) / bm_log1k; // 20..20k
+}
+
+static double
+bm_freq_at_col (uint32_t n_cols, double x)
+{
+	return 20.0 * pow (1000.0, x / n_cols);
+}
+
+static void
+bm_free (struct BinMap* bm)
+{
+	free (bm->col_ptr);
+	free (bm->bin_idx);
+	free (bm->weight);
+	free (bm->sum);
+	free (bm->col_pwr);
+	memset (bm, 0, sizeof (struct BinMap));
+}
+
+static int
+bm_init (struct BinMap* bm, uint32_t max_cols)
+{
+	memset (bm, 0, sizeof (struct BinMap));
+	bm->max_cols = max_cols;
+	bm->col_ptr  = (uint32_t*)malloc ((max_cols + 1) * sizeof (uint32_t));
+	bm->sum      = (bool*)malloc (max_cols * sizeof (bool));
+	bm->col_pwr  = (float*)malloc (max_cols * sizeof (float));
+	if (!bm->col_ptr || !bm->sum || !bm->col_pwr) {
+		bm_free (bm);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+bm_reserve (struct BinMap* bm, uint32_t nnz)
+{
+	if (nnz <= bm->capacity) {
+		return 0;
+	}
+	uint32_t* bi = (uint32_t*)realloc (bm->bin_idx, nnz * sizeof (uint32_t));
+	if (!bi) {
+		return -1;
+	}
+	bm->bin_idx = bi;
+	float* w = (float*)realloc (bm->weight, nnz * sizeof (float));
+	if (!w) {
+		return -1;
+	}
+	bm->weight   = w;
+	bm->capacity = nnz;
+	return 0;
+}
+
+static double
+bm_bin_freq (struct BinMap const* bm, uint32_t i)
+{
+	return bm->bin_freq ? bm->bin_freq[i] : i * bm->freq_per_bin;
+}
+
+/* first usable bin with a frequency >= f (or > f), i_max if none */
+static uint32_t
+bm_find (struct BinMap const* bm, double f, bool above)
+{
+	uint32_t lo = bm->i_min;
+	uint32_t hi = bm->i_max;
+	while (lo < hi) {
+		const uint32_t i  = lo + (hi - lo) / 2;
+		const double   fi = bm_bin_freq (bm, i);
+		if (fi < f || (above && fi == f)) {
+			lo = i + 1;
+		} else {
+			hi = i;
+		}
+	}
+	return lo;
+}
+
+/* linear interpolation between the two bins around the column center */
+static uint32_t
+bm_interpolate (struct BinMap* bm, uint32_t c, uint32_t nnz)
+{
+	const double fc = bm_freq_at_col (bm->n_cols, c + .5);
+	uint32_t     i0 = bm_find (bm, fc, true);
+	if (i0 > bm->i_min) {
+		--i0;
+	}
+	if (i0 + 1 >= bm->i_max) {
+		return nnz;
+	}
+	const double f0 = bm_bin_freq (bm, i0);
+	float w = (fc - f0) / (bm_bin_freq (bm, i0 + 1) - f0);
+	if (w < 0) {
+		w = 0;
+	}
+	bm->bin_idx[nnz]   = i0;
+	bm->weight[nnz++]  = 1.f - w;
+	bm->bin_idx[nnz]   = i0 + 1;
+	bm->weight[nnz++]  = w;
+	bm->sum[c]         = true;
+	return nnz;
+}
+
+static int
+bm_rebuild (struct BinMap* bm, uint32_t n_cols, uint32_t n_bins, binmap_t mode)
+{
+	if (n_cols > bm->max_cols) {
+		return -1;
+	}
+
+	bm->mode   = mode;
+	bm->n_cols = n_cols;
+	bm->n_bins = n_bins;
+
+	if (mode == BM_OCT6 || mode == BM_OCT3) {
+		const double oct = (mode == BM_OCT3) ? 1 / 3.0 : 1 / 6.0;
+		const double bw  = pow (2.0, oct * .5);
+		uint32_t     nnz = 0;
+
+		bm->col_ptr[0] = 0;
+		bm->sum[0]     = false;
+		for (uint32_t c = 1; c < n_cols; ++c) {
+			const double   fc = bm_freq_at_col (n_cols, c + .5);
+			const uint32_t i0 = bm_find (bm, fc / bw, false);
+			const uint32_t i1 = bm_find (bm, fc * bw, true); // exclusive
+			if (bm_reserve (bm, nnz + (i1 > i0 ? i1 - i0 : 0) + 2)) {
+				bm->n_cols = 0;
+				return -1;
+			}
+			bm->col_ptr[c] = nnz;
+			bm->sum[c]     = true;
+			if (i1 > i0) {
+				const float w = 1.f / (i1 - i0);
+				for (uint32_t i = i0; i < i1; ++i) {
+					bm->bin_idx[nnz]  = i;
+					bm->weight[nnz++] = w;
+				}
+			} else {
+				nnz = bm_interpolate (bm, c, nnz);
+			}
+		}
+		bm->col_ptr[n_cols] = nnz;
+		return 0;
+	}
+
+	/* every bin is assigned to exactly one column, same as x_at_freq() */
+	if (bm_reserve (bm, n_bins + 2 * n_cols)) {
+		bm->n_cols = 0;
+		return -1;
+	}
+
+	uint32_t nnz = 0;
+	uint32_t i   = bm->i_min;
+	int      ci  = bm_col_at_freq (n_cols, bm_bin_freq (bm, i));
+
+	/* column 0 remains unused, everything below 20Hz ends up in column 1 */
+	for (uint32_t c = 0; c < n_cols; ++c) {
+		bm->col_ptr[c] = nnz;
+		bm->sum[c]     = mode == BM_POWER;
+		while (c > 0 && i < bm->i_max && ci <= (int)c) {
+			bm->bin_idx[nnz]  = i;
+			bm->weight[nnz++] = 1.f;
+			if (++i < bm->i_max) {
+				ci = bm_col_at_freq (n_cols, bm_bin_freq (bm, i));
+			}
+		}
+		if (nnz == bm->col_ptr[c] && c >= 2) {
+			nnz = bm_interpolate (bm, c, nnz);
+		}
+	}
+	bm->col_ptr[n_cols] = nnz;
+	return 0;
+}
+
+/* uniformly spaced FFT bins.
+ * n_bins: number of FFT bins (fftx_bins), not thread-safe, may allocate
+ */
+static int
+bm_build (struct BinMap* bm, uint32_t n_cols, uint32_t n_bins, double freq_per_bin, binmap_t mode)
+{
+	if (bm->mode == mode && bm->n_cols == n_cols && bm->n_bins == n_bins && !bm->bin_freq && bm->freq_per_bin == freq_per_bin) {
+		return 0;
+	}
+	/* DC and Nyquist are not used */
+	bm->bin_freq     = NULL;
+	bm->freq_per_bin = freq_per_bin;
+	bm->i_min        = 1;
+	bm->i_max        = n_bins - 1;
+	return bm_rebuild (bm, n_cols, n_bins, mode);
+}
+
+/* arbitrary bins, e.g. constant-Q. bin_freq: [n_bins] ascending
+ * center frequencies, which must remain valid and unchanged.
+ */
+static int
+bm_build_freq (struct BinMap* bm, uint32_t n_cols, uint32_t n_bins, float const* bin_freq, binmap_t mode)
+{
+	if (bm->mode == mode && bm->n_cols == n_cols && bm->n_bins == n_bins && bm->bin_freq == bin_freq) {
+		return 0;
+	}
+	bm->bin_freq     = bin_freq;
+	bm->freq_per_bin = 0;
+	bm->i_min        = 0;
+	bm->i_max        = n_bins;
+	return bm_rebuild (bm, n_cols, n_bins, mode);
+}
+
+/* map FFT power to dB per display column */
+static void
+bm_map (struct BinMap* bm, float const* power, float* dB)
+{
+	float* const col_pwr = bm->col_pwr;
+
+	for (uint32_t c = 0; c < bm->n_cols; ++c) {
+		const uint32_t e = bm->col_ptr[c + 1];
+		float          p = 0;
+		if (bm->sum[c]) {
+			for (uint32_t k = bm->col_ptr[c]; k < e; ++k) {
+				p += bm->weight[k] * power[bm->bin_idx[k]];
+			}
+		} else {
+			for (uint32_t k = bm->col_ptr[c]; k < e; ++k) {
+				p = fmaxf (p, power[bm->bin_idx[k]]);
+			}
+		}
+		col_pwr[c] = p;
+	}
+
+	fftx_power_to_dB_n (dB, col_pwr, bm->n_cols);
+}
+
+/* weighted sum of values per display column, regardless of mode.
+ * e.g. cross-spectra which can not be combined using max ().
+ */
+static void
+bm_sum (struct BinMap const* bm, float const* in, float* out)
+{
+	for (uint32_t c = 0; c < bm->n_cols; ++c) {
+		const uint32_t e = bm->col_ptr[c + 1];
+		float          v = 0;
+		for (uint32_t k = bm->col_ptr[c]; k < e; ++k) {
+			v += bm->weight[k] * in[bm->bin_idx[k]];
+		}
+		out[c] = v;
+	}
+}
@@ -0,0 +1,285 @@
+/* constant-Q analysis - decimation cascade
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The input is split into octaves by a cascade of halfband decimators,
+ * octave k runs at rate_k = rate / 2^k. Every octave is analyzed with
+ * the same small FFT of size M and contributes the bins in
+ * [rate_k / 8, rate_k / 4), which is well inside the pass-band of the
+ * decimator that feeds it and free of aliases. The top octave also
+ * covers [rate / 4, rate / 2).
+ *
+ * This results in M / 8 bins per octave down to 20Hz. Compared to a
+ * single FFT of size M * 2^k, bass resolution is the same at a
+ * fraction of the cost, while the top octaves are not oversampled.
+ *
+ * Requires fft.c (shared plans and windows) and halfband.c.
+ */
+
+#define CQ_MAX_OCT 16
+#define CQ_BLOCK   256 // decimation block size
+
+struct CQOctave {
+	struct Halfband dec;   // decimator feeding the next octave
+	float*          ring;  // [2 * M] most recent input at rate_k, mirrored
+	uint32_t        rboff; // ring write position
+	uint32_t        fresh; // samples added since last analysis
+	uint32_t        bin0;  // first result bin
+	uint32_t        j0, j1; // analyzed FFT bins [j0, j1)
+};
+
+struct CQAnalysis {
+	uint32_t fft_size; // M
+	uint32_t n_oct;
+	double   rate;
+
+	uint32_t smps;
+	uint32_t sps;
+
+	float*            fft_in;
+	float*            fft_out;
+	float*            rings;
+	float*            scratch[2]; // [CQ_BLOCK] decimator output
+	float const*      window;
+	fftwf_plan        fftplan; // shared, use fftwf_execute_r2r ()
+	struct FFTShared* shared;
+
+	struct CQOctave oct[CQ_MAX_OCT];
+
+	uint32_t n_bins;
+	float*   power; // [n_bins]
+	float*   freq;  // [n_bins] center frequency of each bin, ascending
+};
+
+static void
+cq_reset (struct CQAnalysis* cq)
+{
+	const uint32_t M = cq->fft_size;
+	memset (cq->rings, 0, sizeof (float) * 2 * M * cq->n_oct);
+	memset (cq->power, 0, sizeof (float) * cq->n_bins);
+	for (uint32_t k = 0; k < cq->n_oct; ++k) {
+		hb_reset (&cq->oct[k].dec);
+		cq->oct[k].rboff = 0;
+		cq->oct[k].fresh = 0;
+	}
+	cq->smps = 0;
+}
+
+static void
+cq_free (struct CQAnalysis* cq)
+{
+	if (!cq) {
+		return;
+	}
+	pthread_mutex_lock (&fftw_planner_lock);
+	if (cq->shared) {
+		ft_shared_release (cq->shared);
+		--instance_count;
+	}
+#ifdef WITH_STATIC_FFTW_CLEANUP
+	/* see fftx_free () */
+	if (instance_count == 0) {
+		fftwf_cleanup ();
+		ft_wisdom_loaded = false;
+	}
+#endif
+	pthread_mutex_unlock (&fftw_planner_lock);
+	fftwf_free (cq->fft_in);
+	fftwf_free (cq->fft_out);
+	free (cq->rings);
+	free (cq->scratch[0]);
+	free (cq->scratch[1]);
+	free (cq->power);
+	free (cq->freq);
+	free (cq);
+}
+
+/* fft_size: per octave FFT size, power of two >= 64 */
+static int
+cq_init (struct CQAnalysis* cq, uint32_t fft_size, double rate)
+{
+	const uint32_t M = fft_size;
+
+	cq->fft_size = M;
+	cq->rate     = rate;
+	cq->smps     = 0;
+	cq->sps      = ceil (rate / 30);
+	cq->shared   = NULL;
+
+	/* add octaves until the lowest one reaches down to 20Hz */
+	cq->n_oct = 1;
+	while (cq->n_oct < CQ_MAX_OCT && rate / (8 << (cq->n_oct - 1)) > 20.0) {
+		++cq->n_oct;
+	}
+
+	cq->n_bins = cq->n_oct * M / 8 + M / 4;
+
+	cq->fft_in     = (float*)fftwf_malloc (sizeof (float) * M);
+	cq->fft_out    = (float*)fftwf_malloc (sizeof (float) * M);
+	cq->rings      = (float*)malloc (sizeof (float) * 2 * M * cq->n_oct);
+	cq->scratch[0] = (float*)malloc (sizeof (float) * CQ_BLOCK);
+	cq->scratch[1] = (float*)malloc (sizeof (float) * CQ_BLOCK);
+	cq->power      = (float*)malloc (sizeof (float) * cq->n_bins);
+	cq->freq       = (float*)malloc (sizeof (float) * cq->n_bins);
+
+	if (!cq->fft_in || !cq->fft_out || !cq->rings || !cq->scratch[0] || !cq->scratch[1] || !cq->power || !cq->freq) {
+		return -1;
+	}
+
+	/* result bins in ascending order: lowest octave first */
+	uint32_t b = 0;
+	for (int k = cq->n_oct - 1; k >= 0; --k) {
+		struct CQOctave* o = &cq->oct[k];
+		const double     rk = rate / (1 << k);
+		hb_init (&o->dec, &hb_octave);
+		o->ring = &cq->rings[2 * k * M];
+		o->bin0 = b;
+		o->j0   = M / 8;
+		o->j1   = k == 0 ? M / 2 : M / 4;
+		for (uint32_t j = o->j0; j < o->j1; ++j, ++b) {
+			cq->freq[b] = j * rk / M;
+		}
+	}
+	assert (b == cq->n_bins);
+
+	cq_reset (cq);
+
+	pthread_mutex_lock (&fftw_planner_lock);
+	cq->shared = ft_shared_acquire (M, W_HANN, 1);
+	if (cq->shared) {
+		cq->window  = cq->shared->window;
+		cq->fftplan = cq->shared->plan;
+		++instance_count;
+	}
+	pthread_mutex_unlock (&fftw_planner_lock);
+
+	return cq->shared ? 0 : -1;
+}
+
+static void
+cq_set_step (struct CQAnalysis* cq, uint32_t sps)
+{
+	cq->sps = sps > 0 ? sps : 1;
+}
+
+static uint32_t
+cq_samples_to_frame (struct CQAnalysis* cq)
+{
+	return cq->smps < cq->sps ? cq->sps - cq->smps : 1;
+}
+
+/* input samples that span the analysis window of the lowest octave */
+static uint32_t
+cq_window (struct CQAnalysis* cq)
+{
+	return cq->fft_size << (cq->n_oct - 1);
+}
+
+/* add n <= CQ_BLOCK samples to the cascade */
+static void
+cq_feed (struct CQAnalysis* cq, uint32_t n, float const* data)
+{
+	const uint32_t mask = cq->fft_size - 1;
+	float const*   in   = data;
+
+	for (uint32_t k = 0; k < cq->n_oct && n > 0; ++k) {
+		struct CQOctave* o = &cq->oct[k];
+		ft_ring_write (o->ring, cq->fft_size, o->rboff, in, n);
+		o->rboff = (o->rboff + n) & mask;
+		o->fresh += n;
+
+		if (k + 1 < cq->n_oct) {
+			float* out = cq->scratch[k & 1];
+			n  = hb_process (&o->dec, in, n, out);
+			in = out;
+		}
+	}
+}
+
+static void
+cq_analyze_octave (struct CQAnalysis* cq, struct CQOctave* o)
+{
+	const uint32_t     M      = cq->fft_size;
+	float const* const window = cq->window;
+	float* const       fi     = cq->fft_in;
+	float const* const fo     = cq->fft_out;
+
+	float const* const ring = &o->ring[o->rboff];
+	for (uint32_t i = 0; i < M; ++i) {
+		fi[i] = ring[i] * window[i];
+	}
+
+	fftwf_execute_r2r (cq->fftplan, cq->fft_in, cq->fft_out);
+
+	float* const power = &cq->power[o->bin0];
+	for (uint32_t j = o->j0; j < o->j1; ++j) {
+		power[j - o->j0] = fo[j] * fo[j] + fo[M - j] * fo[M - j];
+	}
+	o->fresh = 0;
+}
+
+/* Lower octaves are only re-analyzed once 1/8 of their window is new,
+ * their time resolution is M / rate_k regardless of the frame rate.
+ */
+static void
+cq_analyze (struct CQAnalysis* cq, bool all)
+{
+	const uint32_t min_fresh = cq->fft_size / 8;
+	for (uint32_t k = 0; k < cq->n_oct; ++k) {
+		struct CQOctave* o = &cq->oct[k];
+		if (k == 0 || all || o->fresh >= min_fresh) {
+			cq_analyze_octave (cq, o);
+		}
+	}
+}
+
+/* returns 0 if a new frame was analyzed, same as fftx_run() */
+static int
+cq_run (struct CQAnalysis* cq, uint32_t n_samples, float const* data)
+{
+	int rv = -1;
+	while (n_samples > 0) {
+		uint32_t n = MIN (n_samples, CQ_BLOCK);
+		n          = MIN (n, cq_samples_to_frame (cq));
+
+		cq_feed (cq, n, data);
+		data += n;
+		n_samples -= n;
+
+		cq->smps += n;
+		if (cq->smps >= cq->sps) {
+			cq->smps = 0;
+			cq_analyze (cq, false);
+			rv = 0;
+		}
+	}
+	return rv;
+}
+
+/* discard history and analyze the given samples as a new frame */
+static void
+cq_resync (struct CQAnalysis* cq, uint32_t n_samples, float const* data)
+{
+	cq_reset (cq);
+	while (n_samples > 0) {
+		const uint32_t n = MIN (n_samples, CQ_BLOCK);
+		cq_feed (cq, n, data);
+		data += n;
+		n_samples -= n;
+	}
+	cq_analyze (cq, true);
+}
@@ -16,10 +16,21 @@
  * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <fcntl.h>
 #include <fftw3.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#if defined __AVX2__
+#include <immintrin.h>
+#elif defined __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifndef MIN
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
@@ -40,29 +51,198 @@ typedef enum {
 /******************************************************************************
  * internal FFT abstraction
  */
+
+/* plan and window table, shared by all analyzers with the same
+ * window size, type and channel count. Entries are reference counted
+ * and protected by fftw_planner_lock.
+ */
+struct FFTShared {
+	uint32_t          window_size;
+	window_t          window_type;
+	uint32_t          howmany; // channels, batched plan
+	uint32_t          refcount;
+	float*            window; // read-only
+	fftwf_plan        plan;
+	struct FFTShared* next;
+};
+
+static struct FFTShared* ft_shared = NULL;
+
+/* Multi-channel analyzers keep per channel data contiguously, channel c
+ * at offset c * window_size (ringbuf: 2 * window_size), respectively
+ * c * data_size, and use a single batched plan for all channels.
+ */
 struct FFTAnalysis {
 	uint32_t   window_size;
 	window_t   window_type;
 	uint32_t   data_size;
+	uint32_t   n_channels;
 	double     rate;
 	double     freq_per_bin;
 	double     phasediff_step;
-	float*     window;
+	float const* window;
 	float*     fft_in;
 	float*     fft_out;
 	float*     power;
-	float*     phase;
+	float*     phase;   // NULL unless phase tracking was enabled
 	float*     phase_h;
-	fftwf_plan fftplan;
+	fftwf_plan fftplan; // shared, use fftwf_execute_r2r ()
+	struct FFTShared* shared;
 
-	float*   ringbuf;
+	float*   ringbuf; // [2 * window_size] mirrored
 	uint32_t rboff;
 	uint32_t smps;
 	uint32_t sps;
 	uint32_t step;
 	double   phasediff_bin;
+	bool     with_phase;   // track phase for fftx_freq_at_bin()
+	uint32_t phase_frames; // frames analyzed with phase, up to 2
 };
 
+/* ****************************************************************************
+ * wisdom cache
+ *
+ * FFTW wisdom is loaded from a file before the first plan is created
+ * and updated whenever a new plan was measured. The file is shared by
+ * all processes. It is replaced atomically by rename(2), so readers
+ * always see a complete file. Writers are serialized using flock(2)
+ * on <file>.lock.
+ *
+ * X42_FFTW_WISDOM: path of the wisdom file, empty to disable the cache.
+ *                  default: $XDG_CACHE_HOME/x42-fftwf.wisdom
+ * X42_FFTW_FASTSTART: if set, use FFTW_ESTIMATE instead of measuring
+ *                  when there is no wisdom for a given size.
+ */
+
+static bool ft_wisdom_loaded = false;
+
+static bool
+ft_wisdom_path (char* path, size_t len)
+{
+	const char* p = getenv ("X42_FFTW_WISDOM");
+	if (p) {
+		snprintf (path, len, "%s", p);
+		return *p != '\0';
+	}
+	const char* xdg  = getenv ("XDG_CACHE_HOME");
+	const char* home = getenv ("HOME");
+	if (xdg && *xdg) {
+		snprintf (path, len, "%s/x42-fftwf.wisdom", xdg);
+	} else if (home && *home) {
+		snprintf (path, len, "%s/.cache", home);
+		mkdir (path, 0755);
+		snprintf (path, len, "%s/.cache/x42-fftwf.wisdom", home);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool
+ft_fast_start (void)
+{
+	const char* p = getenv ("X42_FFTW_FASTSTART");
+	return p && *p && strcmp (p, "0");
+}
+
+/* fftw_planner_lock must be held */
+static void
+ft_wisdom_import (void)
+{
+	char path[1024];
+	if (ft_wisdom_loaded || !ft_wisdom_path (path, sizeof (path))) {
+		return;
+	}
+	ft_wisdom_loaded = true;
+
+	FILE* f = fopen (path, "r");
+	if (!f) {
+		return;
+	}
+	fftwf_import_wisdom_from_file (f);
+	fclose (f);
+}
+
+/* fftw_planner_lock must be held */
+static void
+ft_wisdom_export (void)
+{
+	char path[1024];
+	char lock[1040];
+	char tmp[1040];
+	if (!ft_wisdom_path (path, sizeof (path))) {
+		return;
+	}
+	snprintf (lock, sizeof (lock), "%s.lock", path);
+	snprintf (tmp, sizeof (tmp), "%s.XXXXXX", path);
+
+	int lfd = open (lock, O_RDWR | O_CREAT, 0644);
+	if (lfd < 0) {
+		return;
+	}
+	if (flock (lfd, LOCK_EX)) {
+		close (lfd);
+		return;
+	}
+
+	/* merge wisdom that was added by other processes meanwhile */
+	FILE* f = fopen (path, "r");
+	if (f) {
+		fftwf_import_wisdom_from_file (f);
+		fclose (f);
+	}
+
+	/* write a new file, and replace the old one only if that succeeded */
+	int fd = mkstemp (tmp);
+	if (fd >= 0) {
+		f = fchmod (fd, 0644) ? NULL : fdopen (fd, "w");
+		if (!f) {
+			close (fd);
+			unlink (tmp);
+		} else {
+			fftwf_export_wisdom_to_file (f);
+			bool ok = 0 == fflush (f) && !ferror (f) && 0 == fsync (fd);
+			ok      = 0 == fclose (f) && ok;
+			if (!ok || rename (tmp, path)) {
+				unlink (tmp);
+			}
+		}
+	}
+	close (lfd); // also releases the lock
+}
+
+static fftwf_plan
+ft_plan_r2r (uint32_t window_size, uint32_t howmany, float* in, float* out, unsigned flags)
+{
+	if (howmany == 1) {
+		return fftwf_plan_r2r_1d (window_size, in, out, FFTW_R2HC, flags);
+	}
+	/* contiguous channels */
+	const int           n    = window_size;
+	const fftwf_r2r_kind kind = FFTW_R2HC;
+	return fftwf_plan_many_r2r (1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, &kind, flags);
+}
+
+/* fftw_planner_lock must be held */
+static fftwf_plan
+ft_plan (uint32_t window_size, uint32_t howmany, float* in, float* out)
+{
+	fftwf_plan plan = NULL;
+	ft_wisdom_import ();
+#ifdef FFTW_WISDOM_ONLY
+	plan = ft_plan_r2r (window_size, howmany, in, out, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+	if (plan) {
+		return plan;
+	}
+	if (ft_fast_start ()) {
+		return ft_plan_r2r (window_size, howmany, in, out, FFTW_ESTIMATE);
+	}
+#endif
+	plan = ft_plan_r2r (window_size, howmany, in, out, FFTW_MEASURE);
+	ft_wisdom_export ();
+	return plan;
+}
+
 /* ****************************************************************************
  * windows
  */
@@ -119,66 +299,362 @@ ft_flattop (float* window, uint32_t n)
 /* ****************************************************************************
  * internal private functions
  */
-static float*
-ft_gen_window (struct FFTAnalysis* ft)
+
+/* Write n <= n_siz samples to a mirrored ring of size 2 * n_siz, every
+ * sample is stored at [i] and [i + n_siz]. The most recent n_siz samples
+ * are then always available contiguously, starting at the (updated)
+ * write offset.
+ */
+static void
+ft_ring_write (float* ring, uint32_t n_siz, uint32_t off, float const* data, uint32_t n)
 {
-	if (ft->window) {
-		return ft->window;
+	const uint32_t n1 = MIN (n, n_siz - off);
+	const uint32_t n2 = n - n1;
+	memcpy (&ring[off], data, sizeof (float) * n1);
+	memcpy (&ring[off + n_siz], data, sizeof (float) * n1);
+	if (n2 > 0) {
+		memcpy (ring, &data[n1], sizeof (float) * n2);
+		memcpy (&ring[n_siz], &data[n1], sizeof (float) * n2);
 	}
-
-	ft->window = (float*)malloc (sizeof (float) * ft->window_size);
+}
+static void
+ft_gen_window (float* window, uint32_t n, window_t type)
+{
 	double sum = .0;
 
 	/* https://en.wikipedia.org/wiki/Window_function */
-	switch (ft->window_type) {
+	switch (type) {
 		default:
 		case W_HANN:
-			sum = ft_hannhamm (ft->window, ft->window_size, .5, .5);
+			sum = ft_hannhamm (window, n, .5, .5);
 			break;
 		case W_HAMMMIN:
-			sum = ft_hannhamm (ft->window, ft->window_size, .54, .46);
+			sum = ft_hannhamm (window, n, .54, .46);
 			break;
 		case W_NUTTALL:
-			sum = ft_bnh (ft->window, ft->window_size, .355768, .487396, .144232, .012604);
+			sum = ft_bnh (window, n, .355768, .487396, .144232, .012604);
 			break;
 		case W_BLACKMAN_NUTTALL:
-			sum = ft_bnh (ft->window, ft->window_size, .3635819, .4891775, .1365995, .0106411);
+			sum = ft_bnh (window, n, .3635819, .4891775, .1365995, .0106411);
 			break;
 		case W_BLACKMAN_HARRIS:
-			sum = ft_bnh (ft->window, ft->window_size, .35875, .48829, .14128, .01168);
+			sum = ft_bnh (window, n, .35875, .48829, .14128, .01168);
 			break;
 		case W_FLAT_TOP:
-			sum = ft_flattop (ft->window, ft->window_size);
+			sum = ft_flattop (window, n);
 			break;
 	}
 
 	const double isum = 2.0 / sum;
-	for (uint32_t i = 0; i < ft->window_size; i++) {
-		ft->window[i] *= isum;
+	for (uint32_t i = 0; i < n; i++) {
+		window[i] *= isum;
+	}
+}
+
+/* ****************************************************************************
+ * shared plans and windows
+ */
+
+static void
+ft_shared_destroy (struct FFTShared* sh)
+{
+	if (sh->plan) {
+		fftwf_destroy_plan (sh->plan);
+	}
+	free (sh->window);
+	free (sh);
+}
+
+/* fftw_planner_lock must be held */
+static struct FFTShared*
+ft_shared_acquire (uint32_t window_size, window_t type, uint32_t howmany)
+{
+	struct FFTShared* sh;
+	for (sh = ft_shared; sh; sh = sh->next) {
+		if (sh->window_size == window_size && sh->window_type == type && sh->howmany == howmany) {
+			++sh->refcount;
+			return sh;
+		}
+	}
+
+	sh = (struct FFTShared*)calloc (1, sizeof (struct FFTShared));
+	if (!sh) {
+		return NULL;
+	}
+	sh->window_size = window_size;
+	sh->window_type = type;
+	sh->howmany     = howmany;
+	sh->refcount    = 1;
+	sh->window      = (float*)malloc (sizeof (float) * window_size);
+	if (!sh->window) {
+		ft_shared_destroy (sh);
+		return NULL;
+	}
+
+	/* only used for planning, the plan is executed with the analyzer's
+	 * fft_in, fft_out. fftwf_malloc: same alignment as those */
+	float* plan_in  = (float*)fftwf_malloc (sizeof (float) * window_size * howmany);
+	float* plan_out = (float*)fftwf_malloc (sizeof (float) * window_size * howmany);
+	if (plan_in && plan_out) {
+		sh->plan = ft_plan (window_size, howmany, plan_in, plan_out);
 	}
+	fftwf_free (plan_in);
+	fftwf_free (plan_out);
 
-	return ft->window;
+	if (!sh->plan) {
+		ft_shared_destroy (sh);
+		return NULL;
+	}
+	ft_gen_window (sh->window, window_size, type);
+
+	sh->next  = ft_shared;
+	ft_shared = sh;
+	return sh;
 }
 
+/* fftw_planner_lock must be held */
 static void
-ft_analyze (struct FFTAnalysis* ft)
+ft_shared_release (struct FFTShared* sh)
 {
-	fftwf_execute (ft->fftplan);
+	if (!sh || --sh->refcount > 0) {
+		return;
+	}
+	for (struct FFTShared** p = &ft_shared; *p; p = &(*p)->next) {
+		if (*p == sh) {
+			*p = sh->next;
+			break;
+		}
+	}
+	ft_shared_destroy (sh);
+}
+
+/* ****************************************************************************
+ * power and phase extraction
+ */
 
-	memcpy (ft->phase_h, ft->phase, sizeof (float) * ft->data_size);
-	ft->power[0] = ft->fft_out[0] * ft->fft_out[0];
-	ft->phase[0] = 0;
+/* polynomial arctan approximation for 0 <= x <= 1,
+ * Abramowitz & Stegun 4.4.49: |error| <= 1e-5 rad,
+ * (measured 1.2e-5 rad max with single-precision rounding)
+ */
+#define FT_ATAN_A1  0.9998660f
+#define FT_ATAN_A3 -0.3302995f
+#define FT_ATAN_A5  0.1801410f
+#define FT_ATAN_A7 -0.0851330f
+#define FT_ATAN_A9  0.0208351f
+
+/* per channel data */
+#define FT_OUT(ft, c)   (&(ft)->fft_out[(c) * (ft)->window_size])
+#define FT_POWER(ft, c) (&(ft)->power[(c) * (ft)->data_size])
+#define FT_PHASE(ft, c) (&(ft)->phase[(c) * (ft)->data_size])
+
+/* reference implementation, analyze bins [i0, i1) of channel c */
+static void
+ft_analyze_scalar (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+	float* const       phase = FT_PHASE (ft, c);
+#define FRe (fo[i])
+#define FIm (fo[ft->window_size - i])
+	for (uint32_t i = i0; i < i1; ++i) {
+		power[i] = (FRe * FRe) + (FIm * FIm);
+		phase[i] = atan2f (FIm, FRe);
+	}
+#undef FRe
+#undef FIm
+}
 
-#define FRe (ft->fft_out[i])
-#define FIm (ft->fft_out[ft->window_size - i])
-	for (uint32_t i = 1; i < ft->data_size - 1; ++i) {
-		ft->power[i] = (FRe * FRe) + (FIm * FIm);
-		ft->phase[i] = atan2f (FIm, FRe);
+static void
+ft_power_scalar (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+#define FRe (fo[i])
+#define FIm (fo[ft->window_size - i])
+	for (uint32_t i = i0; i < i1; ++i) {
+		power[i] = (FRe * FRe) + (FIm * FIm);
 	}
 #undef FRe
 #undef FIm
 }
 
+#if defined __AVX2__ && !defined FFTX_NO_SIMD
+
+#define FT_SIMD_WIDTH 8
+
+static inline __m256
+ft_atan2_avx (__m256 y, __m256 x)
+{
+	const __m256 sgn  = _mm256_set1_ps (-0.f);
+	const __m256 ax   = _mm256_andnot_ps (sgn, x);
+	const __m256 ay   = _mm256_andnot_ps (sgn, y);
+	const __m256 mn   = _mm256_min_ps (ax, ay);
+	const __m256 mx   = _mm256_max_ps (_mm256_max_ps (ax, ay), _mm256_set1_ps (1e-30f));
+	const __m256 a    = _mm256_div_ps (mn, mx);
+	const __m256 s    = _mm256_mul_ps (a, a);
+
+	__m256 r = _mm256_set1_ps (FT_ATAN_A9);
+	r = _mm256_add_ps (_mm256_mul_ps (r, s), _mm256_set1_ps (FT_ATAN_A7));
+	r = _mm256_add_ps (_mm256_mul_ps (r, s), _mm256_set1_ps (FT_ATAN_A5));
+	r = _mm256_add_ps (_mm256_mul_ps (r, s), _mm256_set1_ps (FT_ATAN_A3));
+	r = _mm256_add_ps (_mm256_mul_ps (r, s), _mm256_set1_ps (FT_ATAN_A1));
+	r = _mm256_mul_ps (r, a);
+
+	/* octant fixup: |y| > |x|, x < 0, y < 0 */
+	r = _mm256_blendv_ps (r, _mm256_sub_ps (_mm256_set1_ps (M_PI_2), r), _mm256_cmp_ps (ay, ax, _CMP_GT_OQ));
+	r = _mm256_blendv_ps (r, _mm256_sub_ps (_mm256_set1_ps (M_PI), r), x);
+	return _mm256_xor_ps (r, _mm256_and_ps (y, sgn));
+}
+
+static uint32_t
+ft_analyze_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	const __m256i rev = _mm256_set_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+	uint32_t i;
+	for (i = i0; i + FT_SIMD_WIDTH <= i1; i += FT_SIMD_WIDTH) {
+		const __m256 re = _mm256_loadu_ps (&fo[i]);
+		const __m256 im = _mm256_permutevar8x32_ps (_mm256_loadu_ps (&fo[ft->window_size - i - 7]), rev);
+		_mm256_storeu_ps (&power[i], _mm256_add_ps (_mm256_mul_ps (re, re), _mm256_mul_ps (im, im)));
+		_mm256_storeu_ps (&FT_PHASE (ft, c)[i], ft_atan2_avx (im, re));
+	}
+	return i;
+}
+
+static uint32_t
+ft_power_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	const __m256i rev = _mm256_set_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+	uint32_t i;
+	for (i = i0; i + FT_SIMD_WIDTH <= i1; i += FT_SIMD_WIDTH) {
+		const __m256 re = _mm256_loadu_ps (&fo[i]);
+		const __m256 im = _mm256_permutevar8x32_ps (_mm256_loadu_ps (&fo[ft->window_size - i - 7]), rev);
+		_mm256_storeu_ps (&power[i], _mm256_add_ps (_mm256_mul_ps (re, re), _mm256_mul_ps (im, im)));
+	}
+	return i;
+}
+
+#elif defined __SSE2__ && !defined FFTX_NO_SIMD
+
+#define FT_SIMD_WIDTH 4
+
+static inline __m128
+ft_blend_sse (__m128 a, __m128 b, __m128 mask)
+{
+	return _mm_or_ps (_mm_andnot_ps (mask, a), _mm_and_ps (mask, b));
+}
+
+static inline __m128
+ft_atan2_sse (__m128 y, __m128 x)
+{
+	const __m128 sgn  = _mm_set1_ps (-0.f);
+	const __m128 ax   = _mm_andnot_ps (sgn, x);
+	const __m128 ay   = _mm_andnot_ps (sgn, y);
+	const __m128 mn   = _mm_min_ps (ax, ay);
+	const __m128 mx   = _mm_max_ps (_mm_max_ps (ax, ay), _mm_set1_ps (1e-30f));
+	const __m128 a    = _mm_div_ps (mn, mx);
+	const __m128 s    = _mm_mul_ps (a, a);
+
+	__m128 r = _mm_set1_ps (FT_ATAN_A9);
+	r = _mm_add_ps (_mm_mul_ps (r, s), _mm_set1_ps (FT_ATAN_A7));
+	r = _mm_add_ps (_mm_mul_ps (r, s), _mm_set1_ps (FT_ATAN_A5));
+	r = _mm_add_ps (_mm_mul_ps (r, s), _mm_set1_ps (FT_ATAN_A3));
+	r = _mm_add_ps (_mm_mul_ps (r, s), _mm_set1_ps (FT_ATAN_A1));
+	r = _mm_mul_ps (r, a);
+
+	/* octant fixup: |y| > |x|, x < 0, y < 0 */
+	r = ft_blend_sse (r, _mm_sub_ps (_mm_set1_ps (M_PI_2), r), _mm_cmpgt_ps (ay, ax));
+	/* select on the sign-bit (like blendv), x = -0 is in the left half-plane */
+	r = ft_blend_sse (r, _mm_sub_ps (_mm_set1_ps (M_PI), r), _mm_castsi128_ps (_mm_srai_epi32 (_mm_castps_si128 (x), 31)));
+	return _mm_xor_ps (r, _mm_and_ps (y, sgn));
+}
+
+static uint32_t
+ft_analyze_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+	uint32_t i;
+	for (i = i0; i + FT_SIMD_WIDTH <= i1; i += FT_SIMD_WIDTH) {
+		const __m128 re = _mm_loadu_ps (&fo[i]);
+		__m128       im = _mm_loadu_ps (&fo[ft->window_size - i - 3]);
+		im = _mm_shuffle_ps (im, im, _MM_SHUFFLE (0, 1, 2, 3));
+		_mm_storeu_ps (&power[i], _mm_add_ps (_mm_mul_ps (re, re), _mm_mul_ps (im, im)));
+		_mm_storeu_ps (&FT_PHASE (ft, c)[i], ft_atan2_sse (im, re));
+	}
+	return i;
+}
+
+static uint32_t
+ft_power_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	float const* const fo    = FT_OUT (ft, c);
+	float* const       power = FT_POWER (ft, c);
+	uint32_t i;
+	for (i = i0; i + FT_SIMD_WIDTH <= i1; i += FT_SIMD_WIDTH) {
+		const __m128 re = _mm_loadu_ps (&fo[i]);
+		__m128       im = _mm_loadu_ps (&fo[ft->window_size - i - 3]);
+		im = _mm_shuffle_ps (im, im, _MM_SHUFFLE (0, 1, 2, 3));
+		_mm_storeu_ps (&power[i], _mm_add_ps (_mm_mul_ps (re, re), _mm_mul_ps (im, im)));
+	}
+	return i;
+}
+
+#else
+
+#define FT_SIMD_WIDTH 1
+
+static uint32_t
+ft_analyze_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	return i0;
+}
+
+static uint32_t
+ft_power_simd (struct FFTAnalysis* ft, uint32_t c, uint32_t i0, uint32_t i1)
+{
+	return i0;
+}
+
+#endif
+
+static void
+ft_analyze (struct FFTAnalysis* ft)
+{
+	/* all channels at once */
+	fftwf_execute_r2r (ft->fftplan, ft->fft_in, ft->fft_out);
+
+	for (uint32_t c = 0; c < ft->n_channels; ++c) {
+		FT_POWER (ft, c)[0] = FT_OUT (ft, c)[0] * FT_OUT (ft, c)[0];
+	}
+
+	if (!ft->with_phase) {
+		for (uint32_t c = 0; c < ft->n_channels; ++c) {
+			const uint32_t i = ft_power_simd (ft, c, 1, ft->data_size - 1);
+			ft_power_scalar (ft, c, i, ft->data_size - 1);
+		}
+		return;
+	}
+
+	/* previous phase is kept for fftx_freq_at_bin() */
+	float* tmp  = ft->phase_h;
+	ft->phase_h = ft->phase;
+	ft->phase   = tmp;
+
+	for (uint32_t c = 0; c < ft->n_channels; ++c) {
+		FT_PHASE (ft, c)[0] = 0;
+		const uint32_t i = ft_analyze_simd (ft, c, 1, ft->data_size - 1);
+		ft_analyze_scalar (ft, c, i, ft->data_size - 1);
+	}
+
+	if (ft->phase_frames < 2) {
+		++ft->phase_frames;
+	}
+}
+
 /******************************************************************************
  * public API (static for direct source inclusion)
  */
@@ -190,29 +666,33 @@ FFTX_FN_PREFIX
 void
 fftx_reset (struct FFTAnalysis* ft)
 {
-	for (uint32_t i = 0; i < ft->data_size; ++i) {
-		ft->power[i]   = 0;
-		ft->phase[i]   = 0;
-		ft->phase_h[i] = 0;
-	}
-	for (uint32_t i = 0; i < ft->window_size; ++i) {
-		ft->ringbuf[i] = 0;
-		ft->fft_out[i] = 0;
+	const uint32_t n_ch = ft->n_channels;
+	memset (ft->power, 0, n_ch * ft->data_size * sizeof (float));
+	if (ft->phase) {
+		memset (ft->phase, 0, n_ch * ft->data_size * sizeof (float));
+		memset (ft->phase_h, 0, n_ch * ft->data_size * sizeof (float));
 	}
+	memset (ft->fft_out, 0, n_ch * ft->window_size * sizeof (float));
+	memset (ft->ringbuf, 0, n_ch * 2 * ft->window_size * sizeof (float));
 	ft->rboff = 0;
 	ft->smps  = 0;
 	ft->step  = 0;
+	ft->phase_frames = 0;
 }
 
+/* analyze n_channels synchronously, using a single batched plan */
 FFTX_FN_PREFIX
-void
-fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps)
+int
+fftx_init_multi (struct FFTAnalysis* ft, uint32_t window_size, uint32_t n_channels, double rate, double fps)
 {
+	assert (n_channels > 0);
 	ft->rate           = rate;
 	ft->window_size    = window_size;
+	ft->n_channels     = n_channels;
 	ft->window_type    = W_HANN;
 	ft->data_size      = window_size / 2;
 	ft->window         = NULL;
+	ft->shared         = NULL;
 	ft->rboff          = 0;
 	ft->smps           = 0;
 	ft->step           = 0;
@@ -220,20 +700,38 @@ fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps
 	ft->freq_per_bin   = ft->rate / ft->data_size / 2.f;
 	ft->phasediff_step = M_PI / ft->data_size;
 	ft->phasediff_bin  = 0;
+	ft->with_phase     = false;
+	ft->phase          = NULL;
+	ft->phase_h        = NULL;
 
-	ft->ringbuf = (float*)malloc (window_size * sizeof (float));
-	ft->fft_in  = (float*)fftwf_malloc (sizeof (float) * window_size);
-	ft->fft_out = (float*)fftwf_malloc (sizeof (float) * window_size);
-	ft->power   = (float*)malloc (ft->data_size * sizeof (float));
-	ft->phase   = (float*)malloc (ft->data_size * sizeof (float));
-	ft->phase_h = (float*)malloc (ft->data_size * sizeof (float));
+	ft->ringbuf = (float*)malloc (2 * window_size * n_channels * sizeof (float));
+	ft->fft_in  = (float*)fftwf_malloc (sizeof (float) * window_size * n_channels);
+	ft->fft_out = (float*)fftwf_malloc (sizeof (float) * window_size * n_channels);
+	ft->power   = (float*)malloc (ft->data_size * n_channels * sizeof (float));
+
+	if (!ft->ringbuf || !ft->fft_in || !ft->fft_out || !ft->power) {
+		return -1;
+	}
 
 	fftx_reset (ft);
 
 	pthread_mutex_lock (&fftw_planner_lock);
-	ft->fftplan = fftwf_plan_r2r_1d (window_size, ft->fft_in, ft->fft_out, FFTW_R2HC, FFTW_MEASURE);
-	++instance_count;
+	ft->shared = ft_shared_acquire (window_size, ft->window_type, n_channels);
+	if (ft->shared) {
+		ft->window  = ft->shared->window;
+		ft->fftplan = ft->shared->plan;
+		++instance_count;
+	}
 	pthread_mutex_unlock (&fftw_planner_lock);
+
+	return ft->shared ? 0 : -1;
+}
+
+FFTX_FN_PREFIX
+int
+fftx_init (struct FFTAnalysis* ft, uint32_t window_size, double rate, double fps)
+{
+	return fftx_init_multi (ft, window_size, 1, rate, fps);
 }
 
 FFTX_FN_PREFIX
@@ -243,9 +741,44 @@ fftx_set_window (struct FFTAnalysis* ft, window_t type)
 	if (ft->window_type == type) {
 		return;
 	}
-	ft->window_type = type;
-	free (ft->window);
-	ft->window = NULL;
+	pthread_mutex_lock (&fftw_planner_lock);
+	struct FFTShared* sh = ft_shared_acquire (ft->window_size, type, ft->n_channels);
+	if (sh) {
+		ft_shared_release (ft->shared);
+		ft->shared      = sh;
+		ft->window_type = type;
+		ft->window      = sh->window;
+		ft->fftplan     = sh->plan;
+	}
+	pthread_mutex_unlock (&fftw_planner_lock);
+}
+
+/* enable phase tracking, required for fftx_freq_at_bin().
+ * The phase arrays are allocated on first use (not realtime safe),
+ * and kept when tracking is disabled.
+ */
+FFTX_FN_PREFIX
+int
+fftx_set_phase (struct FFTAnalysis* ft, bool enable)
+{
+	if (ft->with_phase == enable) {
+		return 0;
+	}
+	if (enable && !ft->phase) {
+		const size_t n = ft->data_size * ft->n_channels;
+		float* phase   = (float*)calloc (n, sizeof (float));
+		float* phase_h = (float*)calloc (n, sizeof (float));
+		if (!phase || !phase_h) {
+			free (phase);
+			free (phase_h);
+			return -1;
+		}
+		ft->phase   = phase;
+		ft->phase_h = phase_h;
+	}
+	ft->with_phase   = enable;
+	ft->phase_frames = 0;
+	return 0;
 }
 
 FFTX_FN_PREFIX
@@ -256,8 +789,8 @@ fftx_free (struct FFTAnalysis* ft)
 		return;
 	}
 	pthread_mutex_lock (&fftw_planner_lock);
-	fftwf_destroy_plan (ft->fftplan);
-	if (instance_count > 0) {
+	if (ft->shared) {
+		ft_shared_release (ft->shared);
 		--instance_count;
 	}
 #ifdef WITH_STATIC_FFTW_CLEANUP
@@ -272,10 +805,10 @@ fftx_free (struct FFTAnalysis* ft)
 	 */
 	if (instance_count == 0) {
 		fftwf_cleanup ();
+		ft_wisdom_loaded = false;
 	}
 #endif
 	pthread_mutex_unlock (&fftw_planner_lock);
-	free (ft->window);
 	free (ft->ringbuf);
 	fftwf_free (ft->fft_in);
 	fftwf_free (ft->fft_out);
@@ -286,24 +819,21 @@ fftx_free (struct FFTAnalysis* ft)
 }
 
 static int
-_fftx_run (struct FFTAnalysis* ft,
-           const uint32_t n_samples, float const* const data)
+_fftx_run_multi (struct FFTAnalysis* ft,
+                 const uint32_t n_samples, float const* const* data, uint32_t off)
 {
 	assert (n_samples <= ft->window_size);
 
-	float* const f_buf = ft->fft_in;
-	float* const r_buf = ft->ringbuf;
-
-	const uint32_t n_off = ft->rboff;
 	const uint32_t n_siz = ft->window_size;
-	const uint32_t n_old = n_siz - n_samples;
 
-	for (uint32_t i = 0; i < n_samples; ++i) {
-		r_buf[(i + n_off) % n_siz] = data[i];
-		f_buf[n_old + i]           = data[i];
+	for (uint32_t c = 0; c < ft->n_channels; ++c) {
+		ft_ring_write (&ft->ringbuf[2 * c * n_siz], n_siz, ft->rboff, &data[c][off], n_samples);
 	}
 
-	ft->rboff = (ft->rboff + n_samples) % n_siz;
+	ft->rboff += n_samples;
+	if (ft->rboff >= n_siz) {
+		ft->rboff -= n_siz;
+	}
 #if 1
 	ft->smps += n_samples;
 	if (ft->smps < ft->sps) {
@@ -315,21 +845,14 @@ _fftx_run (struct FFTAnalysis* ft,
 	ft->step = n_samples;
 #endif
 
-	/* copy samples from ringbuffer into fft-buffer */
-	const uint32_t p0s = (n_off + n_samples) % n_siz;
-	if (p0s + n_old >= n_siz) {
-		const uint32_t n_p1 = n_siz - p0s;
-		const uint32_t n_p2 = n_old - n_p1;
-		memcpy (f_buf, &r_buf[p0s], sizeof (float) * n_p1);
-		memcpy (&f_buf[n_p1], &r_buf[0], sizeof (float) * n_p2);
-	} else {
-		memcpy (&f_buf[0], &r_buf[p0s], sizeof (float) * n_old);
-	}
-
-	/* apply window function */
-	float const* const window = ft_gen_window (ft);
-	for (uint32_t i = 0; i < ft->window_size; i++) {
-		ft->fft_in[i] *= window[i];
+	/* apply window function to the most recent window_size samples */
+	float const* const window = ft->window;
+	for (uint32_t c = 0; c < ft->n_channels; ++c) {
+		float const* const r_buf = &ft->ringbuf[2 * c * n_siz + ft->rboff];
+		float* const       f_buf = &ft->fft_in[c * n_siz];
+		for (uint32_t i = 0; i < n_siz; i++) {
+			f_buf[i] = r_buf[i] * window[i];
+		}
 	}
 
 	/* ..and analyze */
@@ -339,20 +862,21 @@ _fftx_run (struct FFTAnalysis* ft,
 	return 0;
 }
 
+/* data: one buffer per channel */
 FFTX_FN_PREFIX
 int
-fftx_run (struct FFTAnalysis* ft,
-          const uint32_t n_samples, float const* const data)
+fftx_run_multi (struct FFTAnalysis* ft,
+                const uint32_t n_samples, float const* const* data)
 {
 	if (n_samples <= ft->window_size) {
-		return _fftx_run (ft, n_samples, data);
+		return _fftx_run_multi (ft, n_samples, data, 0);
 	}
 
 	int      rv = -1;
 	uint32_t n  = 0;
 	while (n < n_samples) {
 		uint32_t step = MIN (ft->window_size, n_samples - n);
-		if (!_fftx_run (ft, step, &data[n])) {
+		if (!_fftx_run_multi (ft, step, data, n)) {
 			rv = 0;
 		}
 		n += step;
@@ -360,6 +884,36 @@ fftx_run (struct FFTAnalysis* ft,
 	return rv;
 }
 
+FFTX_FN_PREFIX
+int
+fftx_run (struct FFTAnalysis* ft,
+          const uint32_t n_samples, float const* const data)
+{
+	assert (ft->n_channels == 1);
+	return fftx_run_multi (ft, n_samples, &data);
+}
+
+/* discard history and analyze the given window_size samples as a new
+ * frame, e.g. after audio was skipped. The phase of this frame is not
+ * related to the previous one.
+ */
+FFTX_FN_PREFIX
+void
+fftx_resync_multi (struct FFTAnalysis* ft, float const* const* data)
+{
+	ft->smps = ft->sps;
+	_fftx_run_multi (ft, ft->window_size, data, 0);
+	ft->step = 0;
+}
+
+FFTX_FN_PREFIX
+void
+fftx_resync (struct FFTAnalysis* ft, float const* const data)
+{
+	assert (ft->n_channels == 1);
+	fftx_resync_multi (ft, &data);
+}
+
 FFTX_FN_PREFIX
 void
 fa_analyze_dsp (struct FFTAnalysis* ft,
@@ -390,6 +944,22 @@ fa_analyze_dsp (struct FFTAnalysis* ft,
  * convenient access functions
  */
 
+/* set the number of samples between analysis frames */
+FFTX_FN_PREFIX
+void
+fftx_set_step (struct FFTAnalysis* ft, uint32_t sps)
+{
+	ft->sps = sps > 0 ? sps : 1;
+}
+
+/* number of samples until the next frame is due */
+FFTX_FN_PREFIX
+uint32_t
+fftx_samples_to_frame (struct FFTAnalysis* ft)
+{
+	return ft->smps < ft->sps ? ft->sps - ft->smps : 1;
+}
+
 FFTX_FN_PREFIX
 uint32_t
 fftx_bins (struct FFTAnalysis* ft)
@@ -438,6 +1008,48 @@ fftx_power_to_dB (float a)
 	return a > 1e-12 ? 10.0 * fast_log10 (a) : -INFINITY;
 }
 
+/* convert an array of power values to dB, same as fftx_power_to_dB() */
+FFTX_FN_PREFIX
+void
+fftx_power_to_dB_n (float* dB, float const* power, const uint32_t n)
+{
+	uint32_t i = 0;
+#if defined __AVX2__ && !defined FFTX_NO_SIMD
+	const __m256i m_exp = _mm256_set1_epi32 (255);
+	const __m256i m_man = _mm256_set1_epi32 (~(255 << 23));
+	const __m256i e_one = _mm256_set1_epi32 (127 << 23);
+	const __m256i e_off = _mm256_set1_epi32 (128);
+	for (; i + 8 <= n; i += 8) {
+		const __m256  a = _mm256_loadu_ps (&power[i]);
+		const __m256i x = _mm256_castps_si256 (a);
+		const __m256i e = _mm256_sub_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (x, 23), m_exp), e_off);
+		const __m256  m = _mm256_castsi256_ps (_mm256_or_si256 (_mm256_and_si256 (x, m_man), e_one));
+		__m256 v = _mm256_add_ps (_mm256_mul_ps (_mm256_set1_ps (-1.0f / 3), m), _mm256_set1_ps (2.f));
+		v = _mm256_sub_ps (_mm256_mul_ps (v, m), _mm256_set1_ps (2.0f / 3));
+		v = _mm256_mul_ps (_mm256_add_ps (v, _mm256_cvtepi32_ps (e)), _mm256_set1_ps (10.f / 3.312500f));
+		_mm256_storeu_ps (&dB[i], _mm256_blendv_ps (_mm256_set1_ps (-INFINITY), v, _mm256_cmp_ps (a, _mm256_set1_ps (1e-12f), _CMP_GT_OQ)));
+	}
+#elif defined __SSE2__ && !defined FFTX_NO_SIMD
+	const __m128i m_exp = _mm_set1_epi32 (255);
+	const __m128i m_man = _mm_set1_epi32 (~(255 << 23));
+	const __m128i e_one = _mm_set1_epi32 (127 << 23);
+	const __m128i e_off = _mm_set1_epi32 (128);
+	for (; i + 4 <= n; i += 4) {
+		const __m128  a = _mm_loadu_ps (&power[i]);
+		const __m128i x = _mm_castps_si128 (a);
+		const __m128i e = _mm_sub_epi32 (_mm_and_si128 (_mm_srli_epi32 (x, 23), m_exp), e_off);
+		const __m128  m = _mm_castsi128_ps (_mm_or_si128 (_mm_and_si128 (x, m_man), e_one));
+		__m128 v = _mm_add_ps (_mm_mul_ps (_mm_set1_ps (-1.0f / 3), m), _mm_set1_ps (2.f));
+		v = _mm_sub_ps (_mm_mul_ps (v, m), _mm_set1_ps (2.0f / 3));
+		v = _mm_mul_ps (_mm_add_ps (v, _mm_cvtepi32_ps (e)), _mm_set1_ps (10.f / 3.312500f));
+		_mm_storeu_ps (&dB[i], ft_blend_sse (_mm_set1_ps (-INFINITY), v, _mm_cmpgt_ps (a, _mm_set1_ps (1e-12f))));
+	}
+#endif
+	for (; i < n; ++i) {
+		dB[i] = fftx_power_to_dB (power[i]);
+	}
+}
+
 FFTX_FN_PREFIX
 float
 fftx_power_at_bin (struct FFTAnalysis* ft, const int b)
@@ -447,15 +1059,65 @@ fftx_power_at_bin (struct FFTAnalysis* ft, const int b)
 
 FFTX_FN_PREFIX
 float
-fftx_freq_at_bin (struct FFTAnalysis* ft, const int b)
+fftx_channel_freq_at_bin (struct FFTAnalysis* ft, uint32_t c, const int b)
 {
-	/* calc phase: difference minus expected difference */
-	float phase = ft->phase[b] - ft->phase_h[b] - (float)b * ft->phasediff_bin;
-	/* clamp to -M_PI .. M_PI */
-	int over = phase / M_PI;
-	over += (over >= 0) ? (over & 1) : -(over & 1);
-	phase -= M_PI * (float)over;
+	if (ft->phase_frames < 2 || ft->step == 0 || ft->step >= ft->window_size) {
+		/* no phase history, or no overlap: phase is unrelated */
+		return ft->freq_per_bin * b;
+	}
+	/* calc phase: difference minus expected difference,
+	 * (double: b * phasediff_bin can be large)
+	 */
+	const uint32_t o = c * ft->data_size;
+	double phase = ft->phase[o + b] - ft->phase_h[o + b] - (double)b * ft->phasediff_bin;
+	/* wrap to -M_PI .. M_PI */
+	phase = remainder (phase, 2.0 * M_PI);
 	/* scale according to overlap */
-	phase *= (ft->data_size / ft->step) / M_PI;
+	phase *= (double)ft->data_size / ft->step / M_PI;
 	return ft->freq_per_bin * ((float)b + phase);
 }
+
+FFTX_FN_PREFIX
+float
+fftx_freq_at_bin (struct FFTAnalysis* ft, const int b)
+{
+	return fftx_channel_freq_at_bin (ft, 0, b);
+}
+
+/* power of the mid (a + b) / 2 and side (a - b) / 2 signals of two
+ * channels, computed from the spectra of the last frame.
+ */
+FFTX_FN_PREFIX
+void
+fftx_pair_power (struct FFTAnalysis* ft, uint32_t a, uint32_t b, float* mid, float* side)
+{
+	const uint32_t     N  = ft->window_size;
+	float const* const fa = FT_OUT (ft, a);
+	float const* const fb = FT_OUT (ft, b);
+
+	mid[0]  = .25f * (fa[0] + fb[0]) * (fa[0] + fb[0]);
+	side[0] = .25f * (fa[0] - fb[0]) * (fa[0] - fb[0]);
+	for (uint32_t i = 1; i < ft->data_size; ++i) {
+		const float mr = fa[i] + fb[i];
+		const float mi = fa[N - i] + fb[N - i];
+		const float sr = fa[i] - fb[i];
+		const float si = fa[N - i] - fb[N - i];
+		mid[i]  = .25f * (mr * mr + mi * mi);
+		side[i] = .25f * (sr * sr + si * si);
+	}
+}
+
+/* real part of the cross spectrum Xa * conj (Xb) of the last frame */
+FFTX_FN_PREFIX
+void
+fftx_pair_cross (struct FFTAnalysis* ft, uint32_t a, uint32_t b, float* cross)
+{
+	const uint32_t     N  = ft->window_size;
+	float const* const fa = FT_OUT (ft, a);
+	float const* const fb = FT_OUT (ft, b);
+
+	cross[0] = fa[0] * fb[0];
+	for (uint32_t i = 1; i < ft->data_size; ++i) {
+		cross[i] = fa[i] * fb[i] + fa[N - i] * fb[N - i];
+	}
+}
@@ -0,0 +1,166 @@
+/* halfband FIR decimator
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Decimate by 2 using a symmetric halfband FIR. Every other tap of a
+ * halfband filter is zero and only every other output sample is
+ * computed, so the filter is evaluated as the two polyphase branches:
+ * the center tap and the odd taps.
+ */
+
+#define HB_HIST 128 // max. filter length, power of two
+
+struct HBFilter {
+	float        center;
+	uint32_t     n_coeff; // odd taps (one side): 1, 3, 5, ..
+	float const* coeff;
+};
+
+/* pass 0 .. fs/8, stop fs*3/8 .. fs/2: -100dB (below the display
+ * range), 31 taps. Kaiser windowed sinc, beta = 10
+ */
+static const float hb_coeff_31[] = {
+	3.116618495e-01f, -8.760711712e-02f, 3.703902044e-02f, -1.525173499e-02f,
+	5.370540400e-03f, -1.438442837e-03f, 2.345339749e-04f, -7.536470254e-06f
+};
+
+static const struct HBFilter hb_octave = { 0.499997774f, 8, hb_coeff_31 };
+
+/* pass 0 .. 20kHz, stop 24.1kHz .. at 88.2kHz (0.2268 fs): -90dB
+ * (-97dB at 96kHz), 127 taps. Kaiser windowed sinc, beta = 9
+ */
+static const float hb_coeff_127[] = {
+	3.179703585e-01f, -1.050871861e-01f, 6.198109029e-02f, -4.314613583e-02f,
+	3.242114775e-02f, -2.540303156e-02f, 2.040152342e-02f, -1.663005611e-02f,
+	1.367360778e-02f, -1.129261908e-02f, 9.338952316e-03f, -7.715710227e-03f,
+	6.356367904e-03f, -5.213215884e-03f, 4.250628923e-03f, -3.440987944e-03f,
+	2.762133812e-03f, -2.195742025e-03f, 1.726269532e-03f, -1.340266182e-03f,
+	1.025922687e-03f, -7.727734157e-04f, 5.715004822e-04f, -4.138032074e-04f,
+	2.923085310e-04f, -2.005056377e-04f, 1.326934048e-04f, -8.393309041e-05f,
+	5.000145189e-05f, -2.734153781e-05f, 1.300990955e-05f, -4.620153615e-06f
+};
+
+static const struct HBFilter hb_audio = { 0.500000823f, 32, hb_coeff_127 };
+
+struct Halfband {
+	struct HBFilter const* f;
+	uint32_t               len; // filter length
+	uint32_t               pos;
+	bool                   odd;
+	float                  hist[2 * HB_HIST]; // mirrored, contiguous history
+};
+
+static void
+hb_reset (struct Halfband* hb)
+{
+	memset (hb->hist, 0, sizeof (hb->hist));
+	hb->pos = 0;
+	hb->odd = false;
+}
+
+static void
+hb_init (struct Halfband* hb, struct HBFilter const* f)
+{
+	hb->f   = f;
+	hb->len = 4 * f->n_coeff - 1;
+	assert (hb->len <= HB_HIST);
+	hb_reset (hb);
+}
+
+/* decimate n samples, returns number of samples written to out.
+ * out may be the same as in (in-place).
+ */
+static uint32_t
+hb_process (struct Halfband* hb, float const* in, uint32_t n, float* out)
+{
+	struct HBFilter const* const f = hb->f;
+	const uint32_t mid = (hb->len - 1) / 2;
+	uint32_t       n_out = 0;
+
+	for (uint32_t i = 0; i < n; ++i) {
+		hb->hist[hb->pos] = hb->hist[hb->pos + HB_HIST] = in[i];
+		hb->pos = (hb->pos + 1) & (HB_HIST - 1);
+
+		hb->odd = !hb->odd;
+		if (hb->odd) {
+			continue;
+		}
+
+		/* the most recent 'len' samples, oldest first */
+		float const* x = &hb->hist[hb->pos + HB_HIST - hb->len];
+		float        y = f->center * x[mid];
+		for (uint32_t k = 0; k < f->n_coeff; ++k) {
+			const uint32_t d = 2 * k + 1;
+			y += f->coeff[k] * (x[mid - d] + x[mid + d]);
+		}
+		out[n_out++] = y;
+	}
+	return n_out;
+}
+
+/* ****************************************************************************
+ * sample-rate reduction to 44.1 or 48kHz, retaining 0 .. 20kHz
+ */
+
+#define HB_MAX_STAGES 3 // up to 384kHz
+
+struct HBCascade {
+	uint32_t        n_stages;
+	struct Halfband st[HB_MAX_STAGES];
+};
+
+static void
+hbc_reset (struct HBCascade* c)
+{
+	for (uint32_t i = 0; i < c->n_stages; ++i) {
+		hb_reset (&c->st[i]);
+	}
+}
+
+/* returns the decimated rate */
+static double
+hbc_init (struct HBCascade* c, double rate)
+{
+	c->n_stages = 0;
+	while (c->n_stages < HB_MAX_STAGES && rate >= 88200) {
+		rate *= .5;
+		++c->n_stages;
+	}
+	/* only the last stage needs the steep filter, previous ones
+	 * pass everything up to 1/4 of their output rate */
+	for (uint32_t i = 0; i < c->n_stages; ++i) {
+		hb_init (&c->st[i], i + 1 == c->n_stages ? &hb_audio : &hb_octave);
+	}
+	return rate;
+}
+
+/* decimation factor */
+static uint32_t
+hbc_factor (struct HBCascade const* c)
+{
+	return 1 << c->n_stages;
+}
+
+/* in-place, returns the number of decimated samples */
+static uint32_t
+hbc_process (struct HBCascade* c, float* buf, uint32_t n)
+{
+	for (uint32_t i = 0; i < c->n_stages; ++i) {
+		n = hb_process (&c->st[i], buf, n, buf);
+	}
+	return n;
+}
@@ -18,6 +18,15 @@
 
 #define BACKGROUND_FFT // use a background thread
 
+#ifndef _WIN32
+#define SHM_EXPORT // optional shared memory export, see shmexport.h
+#define RECORDER   // optional spectrogram recorder, see specrec.h
+#endif
+
+#if defined RECORDER && !defined BACKGROUND_FFT
+#undef RECORDER // the realtime thread must not write to files
+#endif
+
 #define _GNU_SOURCE
 
 #define MODSPECTRE_URI "http://gareus.org/oss/lv2/modspectre"
@@ -37,19 +46,149 @@
 #include <lv2/lv2plug.in/ns/ext/urid/urid.h>
 
 #ifdef BACKGROUND_FFT
+#include <lv2/lv2plug.in/ns/ext/worker/worker.h>
 #include <pthread.h>
 #include "ringbuf.h"
+#include "tribuf.h"
+#include "workpool.c"
 #endif
 
 #include "fft.c"
+#include "halfband.c"
+#include "cqt.c"
+#include "binmap.c"
+#include "bincode.c"
+
+#ifdef SHM_EXPORT
+#include "shmexport.h"
+#endif
+
+#ifdef RECORDER
+#include "specrec.h"
+#endif
+
+#ifdef WITH_STATS
+#include "stats.h"
+#endif
 
 enum {
 	P_AIN = 0,
 	P_RESPONSE,
 	P_NOTIFY,
+	P_MODE,
+	P_FFTSIZE,
+	P_COLUMNS,
+	P_ENCODING,
+	P_FPS,
+	P_OVERLAP,
+	P_ENGINE,
 	P_LAST
 };
 
+/* multichannel variants: audio inputs 2 .. n_ch start at P_LAST,
+ * followed by the mid/side and correlation toggles.
+ */
+#define MAX_CHANNELS 8
+
+enum {
+	PM_MIDSIDE = 0,
+	PM_CORRELATION,
+	PM_LAST
+};
+
+#ifdef WITH_STATS
+/* instrumentation output ports, after all other ports */
+enum {
+	PS_FPS = 0, // analyzed frames per second
+	PS_LATENCY, // mean audio to display latency [ms]
+	PS_WORKER,  // mean analysis time per frame [ms]
+	PS_LOAD,    // run() DSP load [%]
+	PS_SKIPPED, // input skipped or overwritten before analysis [%]
+	PS_LAST
+};
+
+#define STATS_INTERVAL 1.0 // [sec] port update and stats message period
+#define STATS_RING     64  // run() cycles to look back for latency
+#endif
+
+/* FFT sizes 1024 .. 32768 */
+#define FFT_MIN_LOG2 10
+#define FFT_SIZES    6
+#define FFT_MAX      (1 << (FFT_MIN_LOG2 + FFT_SIZES - 1))
+
+/* display columns MIN_COLS .. N_BINS, see the "columns" port */
+#define MIN_COLS 128
+#if N_BINS < MIN_COLS
+#error N_BINS must be at least 128
+#endif
+
+/* analysis engines */
+enum {
+	E_FFT = 0,
+	E_CQT, // constant-Q, per octave FFT of size / 16
+};
+
+/* compact encoding: send a keyframe about once a second */
+#define KEYFRAME_INTERVAL 1.0
+
+/* correlation spectra are averaged over this time [sec] */
+#define CORRELATION_TIME 0.2
+
+/* input with a peak below -120dBFS is silent: the analysis cannot
+ * yield anything above the -96dB display floor (window and mid/side
+ * gain are less than +12dB). Silent frames only decay the display.
+ */
+#define SILENCE_PEAK 1e-6f
+#define SILENCE_HOLD (1U << 30) // max. distance of loud_at to the scanned position
+
+/* analysis result, ready to be sent to the GUI.
+ * N_BINS is the max. number of display columns per trace.
+ *
+ * Traces are consecutive: all channels, then mid and side of each
+ * channel pair (if enabled), then the correlation of each pair (if
+ * enabled). 'data' holds [n_max] bins, followed by the key and delta
+ * words, see sf_bins(), sf_key(), sf_delta().
+ */
+typedef struct {
+	uint32_t  n_cols;
+	uint32_t  n_traces;
+	uint32_t  n_max;    // max. n_traces * n_cols
+	uint32_t  seq;      // frame number
+	bincode_t encoding;
+	bool      changed;  // compared to frame seq - 1
+	bool      keyframe; // periodic keyframe is due
+	uint32_t  n_key;    // compact keyframe size
+	uint32_t  n_delta;  // compact delta size, 0: send keyframe
+#ifdef WITH_STATS
+	uint32_t  pos;      // to_fft read position after analysis
+#endif
+	float     data[];
+} SpectrumFrame;
+
+static size_t
+sf_size (uint32_t n_max)
+{
+	return sizeof (SpectrumFrame) + (n_max + 2 * BC_WORDS (n_max)) * sizeof (float);
+}
+
+static float*
+sf_bins (SpectrumFrame const* f)
+{
+	return (float*)f->data;
+}
+
+static int32_t*
+sf_key (SpectrumFrame const* f)
+{
+	return (int32_t*)&f->data[f->n_max];
+}
+
+static int32_t*
+sf_delta (SpectrumFrame const* f)
+{
+	return &sf_key (f)[BC_WORDS (f->n_max)];
+}
+
 typedef struct {
 	LV2_URID atom_Blank;
 	LV2_URID atom_Object;
@@ -63,13 +202,44 @@ typedef struct {
 
 	LV2_URID spectrum;
 	LV2_URID bin_count;
+	LV2_URID bin_traces;
 	LV2_URID bin_data;
+	LV2_URID bin_code;
+
+#ifdef WITH_STATS
+	LV2_URID stats;
+	LV2_URID stat_period;
+	LV2_URID stat_frames;
+	LV2_URID stat_lost;
+	LV2_URID stat_skipped;
+	LV2_URID stat_dropped;
+	LV2_URID stat_worker;
+	LV2_URID stat_backlog;
+	LV2_URID stat_latency;
+	LV2_URID stat_run;
+#endif
 } MsrURIs;
 
+#ifdef WITH_STATS
+/* snapshot of all counters, see st_report() */
+typedef struct {
+	uint32_t frames;
+	uint32_t lost;
+	uint32_t skipped;
+	uint32_t dropped;
+	st_hist  worker;
+	st_hist  backlog;
+	st_hist  latency;
+	st_hist  run;
+} StatSnapshot;
+#endif
+
 
 typedef struct {
 	/* ports */
-	float* ports[P_LAST];
+	float*       ports[P_LAST];
+	float const* ain[MAX_CHANNELS];
+	float*       ports_multi[PM_LAST];
 
 	/* message ports */
 	LV2_Atom_Sequence*       ctrl_out;
@@ -78,24 +248,106 @@ typedef struct {
 	MsrURIs                  uris;
 
 	/* FFT */
-	struct FFTAnalysis *fftx;
+	struct FFTAnalysis *fft[FFT_SIZES]; // all sizes, allocated by instantiate()
+	struct FFTAnalysis *fftx;           // current, owned by worker
+	struct CQAnalysis  *cq[FFT_SIZES];  // all sizes, mono only
+	struct CQAnalysis  *cqx;            // current, NULL: use fftx
+	struct BinMap       binmap;
+	struct HBCascade*   decim;          // [n_ch] input to analysis rate, owned by worker
+	uint32_t            n_ch;
+	uint32_t            n_pairs;        // channel pairs (0, 1), (2, 3), ..
+	volatile bool       midside_req;    // set by run()
+	volatile bool       corr_req;       // set by run()
+	volatile int        fft_sel;        // requested FFT size, set by run()
+	volatile int        engine_req;     // requested analysis engine, set by run()
+	volatile uint32_t   n_cols_req;     // requested column count, set by run()
+	volatile bincode_t  encoding_req;   // requested wire format, set by run()
+	volatile uint32_t   hop;            // samples per analysis frame, set by run()
+	volatile float      resp_req;       // response time, set by run()
 
 #ifdef BACKGROUND_FFT
-	pthread_mutex_t lock;
-	pthread_cond_t  signal;
-	pthread_t       thread;
-	bool            keep_running;
-
-	ringbuf*        to_fft;
-	ringbuf*        result;
+	struct WPTask   task;
+	bool            pool;   // registered with the thread-pool
+	LV2_Worker_Schedule* schedule; // host provided worker, NULL: use the pool
+	volatile int    job;    // host worker job is scheduled or running
+	bool            job_deferred; // wakeup while a job was pending, owned by run()
+	volatile uint32_t frame_due; // to_fft write position when the next frame is due, set by worker
+	uint32_t        woken_at;    // to_fft write position of the last wakeup
+	volatile uint32_t max_period; // largest n_samples passed to run()
+	uint32_t        loud_wp;     // to_fft write position after the last period with signal, owned by run()
+	volatile bool   idle;        // silent and nothing left to display, set by worker
+	bool            silent;      // analysis is bypassed, owned by worker
+	bool            settled;     // silent and the display reached zero, owned by worker
+	uint32_t        loud_at;     // to_fft position after the last sample above SILENCE_PEAK, owned by worker
+	uint32_t        scanned;     // to_fft position up to which loud_at is known, owned by worker
+
+	ovbuf*          to_fft[MAX_CHANNELS];
+	float*          a_in[MAX_CHANNELS]; // worker scratch [FFT_MAX]
+	avar            rp;        // to_fft read position (all channels), owned by worker
+	volatile uint32_t n_skipped; // samples skipped to catch up, wraps
+	volatile uint32_t n_dropped; // samples overwritten before analysis, wraps
+	tribuf*         result;
+#else
+	SpectrumFrame*  result;
 #endif
 
 	/* config & state */
-	double rate;
-	float bins[N_BINS];
-	float last[N_BINS];
-	float resp;
-	float tc;
+	double   rate;  // analysis rate (after decimation)
+	uint32_t n_cols;
+	uint32_t n_traces;
+	uint32_t n_max;  // [N_BINS * max. traces]
+	uint32_t seq;
+	bool     midside;
+	bool     corr;
+	float*   bins;   // [n_max]
+	float*   last;   // [n_max] as sent to the GUI
+	float*   xcorr;  // [n_pairs * 3 * N_BINS] averaged cross and auto power per column
+	float*   pair_buf; // [FFT_MAX] mid and side power
+	float*   bin_db;   // [FFT_MAX / 2 + 1] power of every FFT bin [dB]
+	float    corr_a; // per frame correlation averaging coefficient
+
+#ifdef SHM_EXPORT
+	mss_export* shm; // NULL unless enabled
+#endif
+#ifdef RECORDER
+	sr_writer*  rec; // NULL unless enabled, owned by worker
+#endif
+
+#ifdef WITH_STATS
+	/* instrumentation, every counter has a single writer */
+	float*            ports_stats[PS_LAST];
+	volatile uint32_t st_frames;  // frames analyzed, worker
+	volatile uint32_t st_lost;    // frames replaced before run() sent them, worker
+	st_hist           st_worker;  // analysis time per frame [us], worker
+	st_hist           st_backlog; // samples pending at wakeup, worker
+	st_hist           st_latency; // audio to display [us], run()
+	st_hist           st_run;     // run() duration [us], run()
+	uint64_t          st_t0;      // start of the current analysis, worker
+
+	/* owned by run() */
+	struct { uint32_t pos; uint64_t t; } st_ring[STATS_RING]; // to_fft write position and time of recent cycles
+	uint32_t          st_ring_w;
+	uint32_t          st_elapsed; // samples since the last report
+	StatSnapshot      st_prev;
+	float             st_value[PS_LAST];
+#endif
+
+	/* owned by run() */
+	uint32_t  tx_seq;
+	uint32_t  tx_cols;
+	uint32_t  tx_traces;
+	bincode_t tx_encoding;
+
+	float    resp;
+	float    tc;           // per frame decay
+	uint32_t key_interval; // frames
+	int      mode;
+
+	/* port cache, owned by run() */
+	float    p_resp;
+	float    p_fps;
+	float    p_overlap;
+	int      p_sel;
 } ModSpectre;
 
 
@@ -103,94 +355,845 @@ typedef struct {
  * FFT
  */
 
-static const float log1k = 6.907755279f; // logf (1000);
 static const float guipx = 0.0028571427; // 0.5 / 175.f; (gui 1/2 px granularity)
 
-static int x_at_freq (float f)
+/* not realtime safe, may allocate and plan. instantiate() only */
+static struct FFTAnalysis*
+fft_get (ModSpectre* self, int sel)
+{
+	if (!self->fft[sel]) {
+		struct FFTAnalysis* ft = (struct FFTAnalysis*)calloc (1, sizeof (struct FFTAnalysis));
+		if (!ft) {
+			return NULL;
+		}
+		if (fftx_init_multi (ft, 1 << (FFT_MIN_LOG2 + sel), self->n_ch, self->rate, 30 /*fps*/)) {
+			fftx_free (ft);
+			return NULL;
+		}
+		self->fft[sel] = ft;
+	}
+	return self->fft[sel];
+}
+
+/* not realtime safe, may allocate and plan. instantiate() only */
+static struct CQAnalysis*
+cq_get (ModSpectre* self, int sel)
+{
+	if (!self->cq[sel]) {
+		struct CQAnalysis* cq = (struct CQAnalysis*)calloc (1, sizeof (struct CQAnalysis));
+		if (!cq) {
+			return NULL;
+		}
+		if (cq_init (cq, 1 << (FFT_MIN_LOG2 + sel - 4), self->rate)) {
+			cq_free (cq);
+			return NULL;
+		}
+		self->cq[sel] = cq;
+	}
+	return self->cq[sel];
+}
+
+/* dispatch to the current analysis engine,
+ * data: one buffer per channel, constant-Q is mono only.
+ */
+static int
+an_run (ModSpectre* self, uint32_t n_samples, float* const* data)
+{
+	if (self->cqx) {
+		return cq_run (self->cqx, n_samples, data[0]);
+	}
+	return fftx_run_multi (self->fftx, n_samples, (float const* const*)data);
+}
+
+static uint32_t
+an_samples_to_frame (ModSpectre* self)
+{
+	if (self->cqx) {
+		return cq_samples_to_frame (self->cqx);
+	}
+	return fftx_samples_to_frame (self->fftx);
+}
+
+static uint32_t
+an_step (ModSpectre* self)
 {
-	return N_BINS * logf (f / 20.0) / log1k; // 20..20k
+	return self->cqx ? self->cqx->sps : self->fftx->sps;
+}
+
+#ifdef BACKGROUND_FFT
+/* samples needed for a complete frame, at most FFT_MAX */
+static uint32_t
+an_window (ModSpectre* self)
+{
+	if (self->cqx) {
+		return MIN (cq_window (self->cqx), FFT_MAX);
+	}
+	return self->fftx->window_size;
 }
 
 static void
-assign_bins (ModSpectre* self)
+an_resync (ModSpectre* self, float* const* data)
+{
+	if (self->cqx) {
+		cq_resync (self->cqx, an_window (self), data[0]);
+	} else {
+		fftx_resync_multi (self->fftx, (float const* const*)data);
+	}
+	self->silent = false;
+}
+
+/* input samples that contribute to a frame: the analysis window and
+ * the decimator history (less than HB_HIST per stage).
+ * Lower constant-Q octaves are decimated, their history is shorter
+ * than another window.
+ */
+static uint32_t
+an_span (ModSpectre* self)
+{
+	const uint32_t dec = hbc_factor (&self->decim[0]);
+	if (self->cqx) {
+		return (2 * cq_window (self->cqx) + HB_HIST) * dec;
+	}
+	return (self->fftx->window_size + HB_HIST) * dec;
+}
+
+/* true if all input that contributes to a frame ending at 'pos' is
+ * silent. New input is scanned up to 'pos' (backwards, signals exit
+ * early). Frames are checked in order, so loud_at is exact: it is
+ * never beyond the frame.
+ */
+static bool
+an_quiet (ModSpectre* self, uint32_t pos, uint32_t span)
 {
-	const float tc = self->tc;
-	for (uint32_t b = 0; b < N_BINS; ++b) {
-		self->bins[b] *= tc;
-		if (self->bins[b] < guipx) {
-			self->bins[b] = 0;
+	if ((int32_t)(pos - self->scanned) > 0) {
+		uint32_t from = self->scanned;
+		if (pos - from > ob_read_max (self->to_fft[0])) {
+			from = pos - ob_read_max (self->to_fft[0]); // overwritten
+		}
+		for (uint32_t c = 0; c < self->n_ch; ++c) {
+			ovbuf const* const ob = self->to_fft[c];
+			for (uint32_t p = pos; p != from && (int32_t)(p - self->loud_at) > 0; --p) {
+				if (fabsf (ob->data[(p - 1) & ob->mask]) > SILENCE_PEAK) {
+					self->loud_at = p;
+					break;
+				}
+			}
+		}
+		self->scanned = pos;
+	}
+	if ((int32_t)(pos - self->loud_at) > (int32_t)SILENCE_HOLD) {
+		self->loud_at = pos - SILENCE_HOLD;
+	}
+	return (int32_t)(pos - self->loud_at) >= (int32_t)span;
+}
+#endif
+
+/* samples per analysis frame.
+ * 'overlap' is the minimum overlap of consecutive windows (0: any),
+ * which may result in a higher frame rate than 'fps'.
+ */
+static uint32_t
+calc_hop (double rate, float fps, float overlap, uint32_t window_size)
+{
+	uint32_t hop = ceil (rate / fps);
+	if (overlap > 0) {
+		const uint32_t h = window_size * (1.f - overlap);
+		if (h < hop) {
+			hop = h;
+		}
+	}
+	return hop > 0 ? hop : 1;
+}
+
+/* number of traces: channels, mid and side, correlation */
+static uint32_t
+calc_traces (uint32_t n_ch, bool midside, bool corr)
+{
+	const uint32_t n_pairs = n_ch / 2;
+	return n_ch + (midside ? 2 * n_pairs : 0) + (corr ? n_pairs : 0);
+}
+
+/* switch to requested engine, FFT size, hop and column count,
+ * returns true if the engine or FFT size changed.
+ */
+static bool
+apply_config (ModSpectre* self)
+{
+	const uint32_t n_cols  = self->n_cols_req;
+	const bool     midside = self->midside_req;
+	const bool     corr    = self->corr_req;
+	if (self->n_cols != n_cols || self->midside != midside || self->corr != corr) {
+		self->n_cols   = n_cols;
+		self->midside  = midside;
+		self->corr     = corr;
+		self->n_traces = calc_traces (self->n_ch, midside, corr);
+		memset (self->bins, 0, sizeof (float) * self->n_max);
+		for (uint32_t b = 0; b < self->n_max; ++b) {
+			self->last[b] = -1;
+		}
+		if (self->xcorr) {
+			memset (self->xcorr, 0, sizeof (float) * 3 * N_BINS * self->n_pairs);
+		}
+#ifdef BACKGROUND_FFT
+		self->settled = false; // send the new layout
+#endif
+	}
+
+	bool changed = false;
+	struct CQAnalysis* cq = NULL;
+	if (self->engine_req == E_CQT) {
+		cq = self->cq[self->fft_sel];
+	}
+	struct FFTAnalysis* ft = cq ? self->fftx : self->fft[self->fft_sel];
+	if (ft && ft != self->fftx) {
+		fftx_reset (ft);
+		self->fftx = ft;
+		changed = true;
+	}
+	if (cq != self->cqx) {
+		if (cq) {
+			cq_reset (cq);
+		}
+		self->cqx = cq;
+		changed = true;
+	}
+
+	/* phase is only needed for phase corrected bin frequencies */
+	fftx_set_phase (self->fftx, self->mode == 0 && !self->cqx);
+
+	/* decay is applied once per frame */
+	const uint32_t hop  = self->hop;
+	const float    resp = self->resp_req;
+	if (changed || an_step (self) != hop || self->resp != resp) {
+		if (self->cqx) {
+			cq_set_step (self->cqx, hop);
+		} else {
+			fftx_set_step (self->fftx, hop);
 		}
+		self->resp = resp;
+		self->tc   = expf (-2.0 * M_PI * resp * hop / self->rate);
+		self->key_interval = ceil (KEYFRAME_INTERVAL * self->rate / hop);
+		self->corr_a = 1.f - expf (-(double)hop / (CORRELATION_TIME * self->rate));
 	}
-	for (uint32_t i = 1; i < self->fftx->data_size - 1; ++i) {
-		const float pab = fftx_power_at_bin(self->fftx, i);
-		const float frq = fftx_freq_at_bin (self->fftx, i);
+	if (changed && self->xcorr) {
+		memset (self->xcorr, 0, sizeof (float) * 3 * N_BINS * self->n_pairs);
+	}
+	return changed;
+}
+
+/* phase corrected frequency of every FFT bin (slow) */
+static void
+assign_bins_precise (ModSpectre* self, uint32_t c, float* bins)
+{
+	const uint32_t n_bins = self->fftx->data_size - 1;
+	float* const   pdb    = self->bin_db;
+	fftx_power_to_dB_n (pdb, FT_POWER (self->fftx, c), n_bins);
+
+	for (uint32_t i = 1; i < n_bins; ++i) {
+		const float pab = pdb[i];
+		const float frq = fftx_channel_freq_at_bin (self->fftx, c, i);
 		if (pab <= -96.f) {
 			continue;
 		}
-		int b = x_at_freq (frq);
-		if (b >= N_BINS) {
+		int b = bm_col_at_freq (self->n_cols, frq);
+		if (b >= (int)self->n_cols) {
 			continue;
 		}
 		if (b < 2) {
 			b = 1;
 		}
 		float pwr = 1.f - pab / -96.f;
-		if (pwr > self->bins[b]) {
-			self->bins[b] = pwr;
+		if (pwr > bins[b]) {
+			bins[b] = pwr;
+		}
+	}
+}
+
+/* nominal bin frequency, using precomputed bin -> column map */
+static void
+assign_bins_mapped (ModSpectre* self, float const* power, float* bins)
+{
+	float cdb[N_BINS];
+	bm_map (&self->binmap, power, cdb);
+
+	for (uint32_t b = 0; b < self->n_cols; ++b) {
+		if (cdb[b] <= -96.f) {
+			continue;
+		}
+		float pwr = 1.f - cdb[b] / -96.f;
+		if (pwr > bins[b]) {
+			bins[b] = pwr;
+		}
+	}
+}
+
+/* mid and side power of each channel pair */
+static void
+assign_midside (ModSpectre* self, float* bins)
+{
+	const uint32_t n_cols = self->n_cols;
+	float* const   mid    = self->pair_buf;
+	float* const   side   = &self->pair_buf[FFT_MAX / 2];
+
+	for (uint32_t p = 0; p < self->n_pairs; ++p) {
+		fftx_pair_power (self->fftx, 2 * p, 2 * p + 1, mid, side);
+		assign_bins_mapped (self, mid, &bins[2 * p * n_cols]);
+		assign_bins_mapped (self, side, &bins[(2 * p + 1) * n_cols]);
+	}
+}
+
+/* time average of a column spectrum */
+static void
+correlation_avg (float* avg, float const* col, float a, uint32_t n_cols)
+{
+	for (uint32_t b = 0; b < n_cols; ++b) {
+		avg[b] += a * (col[b] - avg[b]);
+	}
+}
+
+/* display values of the averaged spectra, returns true if all
+ * columns are silent */
+static bool
+correlation_out (float const* sab, float const* saa, float const* sbb, uint32_t n_cols, float* out)
+{
+	bool silent = true;
+	for (uint32_t b = 0; b < n_cols; ++b) {
+		const float pp = saa[b] * sbb[b];
+		if (pp < 1e-20f) { // -96dB
+			out[b] = 0;
+			continue;
+		}
+		silent = false;
+		const float r = sab[b] / sqrtf (pp);
+		out[b] = r < -1.f ? 0.f : (r > 1.f ? 1.f : .5f * (1.f + r));
+	}
+	return silent;
+}
+
+/* Phase correlation of each channel pair per column:
+ * Re (Sab) / sqrt (Saa * Sbb), using time averaged cross and auto
+ * power spectra. -1 .. +1 is displayed as 0 .. 1, silent columns
+ * are 0.
+ */
+static void
+assign_correlation (ModSpectre* self, float* bins)
+{
+	const uint32_t n_cols = self->n_cols;
+	const float    a      = self->corr_a;
+	float* const   cross  = self->pair_buf;
+	float          col[N_BINS];
+
+	for (uint32_t p = 0; p < self->n_pairs; ++p) {
+		float* const sab = &self->xcorr[3 * p * N_BINS];
+		float* const saa = &sab[N_BINS];
+		float* const sbb = &saa[N_BINS];
+
+		fftx_pair_cross (self->fftx, 2 * p, 2 * p + 1, cross);
+		bm_sum (&self->binmap, cross, col);
+		correlation_avg (sab, col, a, n_cols);
+		bm_sum (&self->binmap, FT_POWER (self->fftx, 2 * p), col);
+		correlation_avg (saa, col, a, n_cols);
+		bm_sum (&self->binmap, FT_POWER (self->fftx, 2 * p + 1), col);
+		correlation_avg (sbb, col, a, n_cols);
+
+		correlation_out (sab, saa, sbb, n_cols, &bins[p * n_cols]);
+	}
+}
+
+/* per frame decay of all but the correlation traces,
+ * returns true if all of them are zero */
+static bool
+decay_bins (ModSpectre* self)
+{
+	const uint32_t n_decay = self->n_cols * (self->n_ch + (self->midside ? 2 * self->n_pairs : 0));
+	const float    tc      = self->tc;
+	float* const   bins    = self->bins;
+	bool           zero    = true;
+
+	for (uint32_t b = 0; b < n_decay; ++b) {
+		bins[b] *= tc;
+		if (bins[b] < guipx) {
+			bins[b] = 0;
+		} else {
+			zero = false;
+		}
+	}
+	return zero;
+}
+
+static void
+assign_bins (ModSpectre* self)
+{
+	const uint32_t n_cols = self->n_cols;
+	float* const   bins   = self->bins;
+
+	decay_bins (self);
+
+	/* no phase for constant-Q, mid/side and correlation:
+	 * precise mode falls back to peak */
+	const int      mode  = self->mode;
+	const binmap_t bmode = (binmap_t)(mode > 0 ? mode - 1 : BM_PEAK);
+
+	if (self->cqx) {
+		struct CQAnalysis* cq = self->cqx;
+		if (0 == bm_build_freq (&self->binmap, n_cols, cq->n_bins, cq->freq, bmode)) {
+			assign_bins_mapped (self, cq->power, bins);
+		}
+		return;
+	}
+
+	struct FFTAnalysis* ft = self->fftx;
+	const bool mapped = 0 == bm_build (&self->binmap, n_cols, fftx_bins (ft), ft->freq_per_bin, bmode);
+
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		if (mode > 0 && mapped) {
+			assign_bins_mapped (self, FT_POWER (ft, c), &bins[c * n_cols]);
+		} else {
+			assign_bins_precise (self, c, &bins[c * n_cols]);
+		}
+	}
+
+	if (!mapped) {
+		return;
+	}
+
+	uint32_t t = self->n_ch;
+	if (self->midside) {
+		assign_midside (self, &bins[t * n_cols]);
+		t += 2 * self->n_pairs;
+	}
+	if (self->corr) {
+		assign_correlation (self, &bins[t * n_cols]);
+	}
+}
+
+#ifdef BACKGROUND_FFT
+/* frame of silent input, instead of assign_bins(): nothing reaches the
+ * display floor, only the decay is applied and the averaged correlation
+ * spectra decay towards zero. Returns true once every value is zero.
+ */
+static bool
+assign_silence (ModSpectre* self)
+{
+	bool zero = decay_bins (self);
+	if (!self->corr) {
+		return zero;
+	}
+
+	const uint32_t n_cols = self->n_cols;
+	const float    a      = self->corr_a;
+	float* const   bins   = &self->bins[n_cols * (self->n_ch + (self->midside ? 2 * self->n_pairs : 0))];
+	float* const   col    = self->pair_buf;
+
+	/* same as the analysis of digital silence */
+	memset (col, 0, n_cols * sizeof (float));
+	for (uint32_t p = 0; p < self->n_pairs; ++p) {
+		float* const sab = &self->xcorr[3 * p * N_BINS];
+		float* const saa = &sab[N_BINS];
+		float* const sbb = &saa[N_BINS];
+		correlation_avg (sab, col, a, n_cols);
+		correlation_avg (saa, col, a, n_cols);
+		correlation_avg (sbb, col, a, n_cols);
+		if (!correlation_out (sab, saa, sbb, n_cols, &bins[p * n_cols])) {
+			zero = false;
+		}
+	}
+	return zero;
+}
+#endif
+
+/* change detection and encoding, prepare frame for run() to send */
+static void
+prepare_frame (ModSpectre* self, SpectrumFrame* f)
+{
+	const uint32_t n_cols = self->n_cols;
+	const uint32_t n_val  = n_cols * self->n_traces;
+	bool changed[n_val];
+
+	f->changed = false;
+	for (uint32_t b = 0; b < n_val; ++b) {
+		changed[b] = fabsf (self->last[b] - self->bins[b]) >= guipx;
+		if (changed[b]) {
+			self->last[b] = self->bins[b];
+			f->changed = true;
 		}
 	}
+
+	f->n_cols   = n_cols;
+	f->n_traces = self->n_traces;
+	f->n_max    = self->n_max;
+	f->seq      = ++self->seq;
+	f->encoding = self->encoding_req;
+	f->keyframe = (f->seq % self->key_interval) == 0;
+	memcpy (sf_bins (f), self->last, sizeof (float) * n_val);
+
+	if (f->encoding == BC_FLOAT) {
+		f->n_key = f->n_delta = 0;
+		return;
+	}
+
+	f->n_key   = bc_encode (sf_key (f), BC_WORDS (f->n_max), self->last, NULL, n_val, f->encoding);
+	f->n_delta = 0;
+	if (f->changed && !f->keyframe) {
+		f->n_delta = bc_encode (sf_delta (f), BC_WORDS (f->n_max), self->last, changed, n_val, f->encoding);
+		if (f->n_delta >= f->n_key) {
+			f->n_delta = 0;
+		}
+	}
+}
+
+#ifdef SHM_EXPORT
+/* X42_MODSPECTRE_SHM: set to "1" to publish the analysis of every
+ * instance to shared memory, see tools/modspectre-shm.c
+ */
+static bool
+shm_enabled (void)
+{
+	const char* p = getenv ("X42_MODSPECTRE_SHM");
+	return p && *p && strcmp (p, "0");
 }
 
+static void
+shm_export (ModSpectre* self)
+{
+	if (!self->shm) {
+		return;
+	}
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	mss_frame f;
+	memset (&f, 0, sizeof (f));
+	f.frame    = self->seq;
+	f.time_ns  = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	f.rate     = self->rate;
+	f.fft_size = self->cqx ? 0 : self->fftx->window_size;
+	f.n_cols   = self->n_cols;
+	f.n_traces = self->n_traces;
+	f.flags    = (self->midside ? MSS_MIDSIDE : 0) | (self->corr ? MSS_CORRELATION : 0);
+	mss_publish (self->shm, &f, self->bins);
+}
+#endif
+
+#ifdef RECORDER
+/* X42_MODSPECTRE_REC: directory to record the analysis of every instance to.
+ * X42_MODSPECTRE_REC_SIZE: max. file size per instance [MiB], default 64
+ */
+static sr_writer*
+rec_create (uint32_t n_max, uint32_t n_ch)
+{
+	const char* dir = getenv ("X42_MODSPECTRE_REC");
+	if (!dir || !*dir) {
+		return NULL;
+	}
+	const char* sz  = getenv ("X42_MODSPECTRE_REC_SIZE");
+	size_t      mib = sz ? atoi (sz) : 64;
+	if (mib < 1) {
+		mib = 1;
+	}
+
+	static uint32_t rec_id = 0;
+	char path[1024];
+	snprintf (path, sizeof (path), "%s/modspectre-%d-%u.msr", dir, (int)getpid (), __atomic_fetch_add (&rec_id, 1, __ATOMIC_RELAXED));
+
+	sr_writer* w = sr_create (path, mib << 20, n_max, n_ch);
+	if (!w) {
+		fprintf (stderr, "modspectre.lv2: cannot create recording '%s'\n", path);
+	}
+	return w;
+}
+
+static void
+rec_append (ModSpectre* self)
+{
+	if (!self->rec) {
+		return;
+	}
+	sr_record head;
+	memset (&head, 0, sizeof (head));
+	head.rate     = self->rate;
+	head.frame    = self->seq;
+	head.fft_size = self->cqx ? 0 : self->fftx->window_size;
+	head.n_cols   = self->n_cols;
+	head.n_traces = self->n_traces;
+	head.flags    = (self->midside ? SR_MIDSIDE : 0) | (self->corr ? SR_CORRELATION : 0);
+	sr_append (self->rec, &head, self->bins);
+}
+#endif
+
+#ifdef BATCH_ANALYSIS
+/* offline analysis, called for every frame, see tools/modspectre-batch.c */
+static void batch_frame (ModSpectre* self);
+#endif
+
 #ifdef BACKGROUND_FFT
-static void*
+static void
+publish (ModSpectre* self)
+{
+	SpectrumFrame* f = (SpectrumFrame*) tb_back (self->result);
+	prepare_frame (self, f);
+#ifdef SHM_EXPORT
+	shm_export (self);
+#endif
+#ifdef RECORDER
+	rec_append (self);
+#endif
+#ifdef BATCH_ANALYSIS
+	batch_frame (self);
+#endif
+#ifdef WITH_STATS
+	f->pos = self->rp;
+	st_add (&self->st_frames, 1);
+	st_hist_add (&self->st_worker, (st_now () - self->st_t0) / 1000);
+	if (tb_publish (self->result)) {
+		st_add (&self->st_lost, 1);
+	}
+#else
+	tb_publish (self->result);
+#endif
+}
+
+/* read n samples of every channel at rp, and decimate them.
+ * Returns the number of decimated samples, or -1 if the data was
+ * overwritten while reading.
+ */
+static int
+read_input (ModSpectre* self, uint32_t n, bool reset)
+{
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		avar rp = self->rp;
+		if (ob_read (self->to_fft[c], &rp, self->a_in[c], n)) {
+			return -1;
+		}
+	}
+	self->rp += n;
+
+	uint32_t n_an = n;
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		if (reset) {
+			hbc_reset (&self->decim[c]);
+		}
+		n_an = hbc_process (&self->decim[c], self->a_in[c], n);
+	}
+	return n_an;
+}
+
+/* called from the shared thread-pool, or the host's worker */
+static void
 worker (void* arg)
 {
 	ModSpectre* self = (ModSpectre*)arg;
 
-	pthread_mutex_lock (&self->lock);
-	while (self->keep_running) {
-		// wait for signal
-		pthread_cond_wait (&self->signal, &self->lock);
+	/* while the input is silent, the engine is only resynced
+	 * once a signal arrives */
+	bool resync = apply_config (self) && !self->silent;
 
-		if (!self->keep_running) {
-			break;
+	/* to_fft is at the input rate, positions and sizes are scaled.
+	 * Channels are written in order, the last one has the least data. */
+	ovbuf* const   ob     = self->to_fft[self->n_ch - 1];
+	const uint32_t dec    = hbc_factor (&self->decim[0]);
+	const uint32_t window = an_window (self) * dec;
+	const uint32_t span   = an_span (self);
+
+#ifdef WITH_STATS
+	st_hist_add (&self->st_backlog, ob_read_space (ob, self->rp));
+#endif
+
+	size_t n_samples;
+	while ((n_samples = ob_read_space (ob, self->rp)) > 0) {
+#ifdef WITH_STATS
+		self->st_t0 = st_now ();
+#endif
+		if (resync) {
+			/* a new engine or FFT size starts with a complete window */
+			resync = false;
+			ob_read_latest (ob, &self->rp, window);
+			if (read_input (self, window, true) >= 0) {
+				an_resync (self, self->a_in);
+				assign_bins (self);
+				publish (self);
+			}
+			continue;
 		}
 
-		size_t n_samples = rb_read_space (self->to_fft);
-		do {
-			if (n_samples < 1) {
-				break;
+		/* silence: nothing reaches the display, the next frame only
+		 * decays it, until every value is zero. After that frames are
+		 * skipped without being sent.
+		 */
+		const uint32_t n_frame = (self->silent ? an_step (self) : an_samples_to_frame (self)) * dec;
+		if (n_samples >= n_frame && an_quiet (self, self->rp + n_frame, span)) {
+			self->rp += n_frame;
+			if (!self->silent) {
+				self->silent  = true;
+				self->settled = false;
 			}
-			if (n_samples > 8192) {
-				n_samples = 8192;
+			if (!self->settled) {
+				self->settled = assign_silence (self);
+				publish (self);
 			}
+			continue;
+		}
 
-			float a_in[8192];
-			rb_read (self->to_fft, a_in, n_samples);
+		if (self->silent) {
+			if (n_samples < n_frame) {
+				break; // wait for the complete frame
+			}
+			/* signal: analyze the complete window of this frame */
+			self->rp += n_frame - window;
+			if (read_input (self, window, true) >= 0) {
+				an_resync (self, self->a_in);
+				assign_bins (self);
+				publish (self);
+			} else {
+				self->silent = false; // overwritten, skip ahead
+			}
+			continue;
+		}
 
-			if (0 == fftx_run (self->fftx, n_samples, a_in)) {
+		/* more than one frame behind (in addition to the most recent
+		 * host-period): only the most recent window is of interest.
+		 * Skip ahead and analyze it right away.
+		 */
+		if (n_samples > window + self->hop * dec + self->max_period) {
+			const size_t skip = n_samples - window;
+			if (n_samples > ob_read_max (ob)) {
+				self->n_dropped += skip; // overrun, data was overwritten
+			} else {
+				self->n_skipped += skip;
+			}
+			ob_read_latest (ob, &self->rp, window);
+			if (read_input (self, window, true) >= 0) {
+				an_resync (self, self->a_in);
 				assign_bins (self);
-				float ignore = 1;
-				rb_write (self->result, &ignore, 1); // acts as mem-barrier
+				publish (self);
 			}
+			continue;
+		}
 
-			n_samples = rb_read_space (self->to_fft);
-		} while (n_samples > 0);
+		/* process at most one frame per iteration */
+		if (n_samples > n_frame) {
+			n_samples = n_frame;
+		}
+		if (n_samples > FFT_MAX * dec) {
+			n_samples = FFT_MAX * dec;
+		}
+
+		const int n_an = read_input (self, n_samples, false);
+		if (n_an < 0) {
+			continue; // overwritten while reading
+		}
+		if (n_an > 0 && 0 == an_run (self, n_an, self->a_in)) {
+			assign_bins (self);
+			publish (self);
+		}
 	}
-	pthread_mutex_unlock (&self->lock);
-	return NULL;
+
+	self->frame_due = self->rp + (self->silent ? an_step (self) : an_samples_to_frame (self)) * dec;
+
+	/* nothing to do until a signal arrives, see feed_fft() */
+	self->idle = self->silent && self->settled && an_quiet (self, self->rp + ob_read_space (ob, self->rp), span);
+}
+
+/* realtime safe, wake up the analysis, returns false if it has to be retried */
+static bool
+submit (ModSpectre* self)
+{
+	if (!self->schedule) {
+		wp_submit (&self->task);
+		return true;
+	}
+	/* a job processes all data that is available when it runs,
+	 * only one is scheduled at a time. work_response() resets it,
+	 * end_run() catches up. */
+	if (self->job) {
+		self->job_deferred = true;
+		return false;
+	}
+	/* set first, some hosts run the job synchronously (freewheeling) */
+	self->job = 1;
+	if (self->schedule->schedule_work (self->schedule->handle, 0, NULL) != LV2_WORKER_SUCCESS) {
+		self->job = 0;
+		return false;
+	}
+	return true;
+}
+
+/* true if any sample is above SILENCE_PEAK, signals exit early */
+static bool
+has_signal (ModSpectre* self, uint32_t n_samples)
+{
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		float const* const in = self->ain[c];
+		for (uint32_t i = n_samples; i > 0; --i) {
+			if (fabsf (in[i - 1]) > SILENCE_PEAK) {
+				return true;
+			}
+		}
+	}
+	return false;
 }
 
 static void
-feed_fft (ModSpectre* self, const float* data, size_t n_samples)
+feed_fft (ModSpectre* self, size_t n_samples)
 {
-	rb_write (self->to_fft, data, n_samples);
+	/* never blocks or fails, the oldest data is overwritten if the
+	 * worker falls behind. */
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		ob_write (self->to_fft[c], self->ain[c], n_samples);
+	}
+
+	if (n_samples > self->max_period) {
+		self->max_period = n_samples;
+	}
 
-	if (pthread_mutex_trylock (&self->lock) == 0) {
-		pthread_cond_signal (&self->signal);
-		pthread_mutex_unlock (&self->lock);
+	/* only wake up the worker once there is enough data for a frame,
+	 * or at least once per hop (in case the configuration changed).
+	 * When idle, only for signal, or about once per FFT_MAX samples
+	 * to keep up with the configuration and the read position.
+	 */
+	const uint32_t wp  = ob_write_pos (self->to_fft[0]);
+	const uint32_t due = self->frame_due;
+	const uint32_t dec = hbc_factor (&self->decim[0]);
+	bool           wake;
+	if (has_signal (self, n_samples)) {
+		self->loud_wp = wp;
+	}
+	if (self->idle) {
+		wake = (int32_t)(self->loud_wp - self->woken_at) > 0 || wp - self->woken_at >= FFT_MAX * dec;
+	} else {
+		wake = ((int32_t)(wp - due) >= 0 && (int32_t)(self->woken_at - due) < 0)
+		       || wp - self->woken_at >= self->hop * dec;
+	}
+	if (wake && submit (self)) {
+		self->woken_at = wp;
 	}
 }
+#else
+
+/* decimate and analyze in run(), returns true if a frame is ready */
+static bool
+analyze (ModSpectre* self, uint32_t n_samples)
+{
+	bool     rv  = false;
+	uint32_t off = 0;
+	float    buf[MAX_CHANNELS][256];
+	float*   ch[MAX_CHANNELS];
+	while (n_samples > 0) {
+		const uint32_t n    = MIN (n_samples, 256);
+		uint32_t       n_an = 0;
+		for (uint32_t c = 0; c < self->n_ch; ++c) {
+			ch[c] = buf[c];
+			memcpy (buf[c], &self->ain[c][off], n * sizeof (float));
+			n_an = hbc_process (&self->decim[c], buf[c], n);
+		}
+		if (n_an > 0 && 0 == an_run (self, n_an, ch)) {
+			rv = true;
+		}
+		off += n;
+		n_samples -= n;
+	}
+	return rv;
+}
 #endif
 
 /* *****************************************************************************
@@ -217,14 +1220,44 @@ map_uris (LV2_URID_Map* map, MsrURIs* uris)
 	uris->patch_property      = map->map (map->handle, LV2_PATCH__property);
 	uris->patch_value         = map->map (map->handle, LV2_PATCH__value);
 
+	uris->spectrum            = map->map (map->handle, MODSPECTRE_URI "#spectrum");
 	uris->bin_count           = map->map (map->handle, MODSPECTRE_URI "#bin_count");
+	uris->bin_traces          = map->map (map->handle, MODSPECTRE_URI "#bin_traces");
 	uris->bin_data            = map->map (map->handle, MODSPECTRE_URI "#bin_data");
+	uris->bin_code            = map->map (map->handle, MODSPECTRE_URI "#bin_code");
+
+#ifdef WITH_STATS
+	uris->stats               = map->map (map->handle, MODSPECTRE_URI "#stats");
+	uris->stat_period         = map->map (map->handle, MODSPECTRE_URI "#stat_period");
+	uris->stat_frames         = map->map (map->handle, MODSPECTRE_URI "#stat_frames");
+	uris->stat_lost           = map->map (map->handle, MODSPECTRE_URI "#stat_lost");
+	uris->stat_skipped        = map->map (map->handle, MODSPECTRE_URI "#stat_skipped");
+	uris->stat_dropped        = map->map (map->handle, MODSPECTRE_URI "#stat_dropped");
+	uris->stat_worker         = map->map (map->handle, MODSPECTRE_URI "#stat_worker");
+	uris->stat_backlog        = map->map (map->handle, MODSPECTRE_URI "#stat_backlog");
+	uris->stat_latency        = map->map (map->handle, MODSPECTRE_URI "#stat_latency");
+	uris->stat_run            = map->map (map->handle, MODSPECTRE_URI "#stat_run");
+#endif
 }
 
 static void
-tx_to_gui (ModSpectre* self, const float* bins, int32_t n_bins)
+tx_to_gui (ModSpectre* self, const float* bins, int32_t n_bins, bool with_count)
 {
 	LV2_Atom_Forge_Frame frame;
+
+	/* add integer attribute 'bin_count' (display columns), the GUI keeps it */
+	if (with_count) {
+		lv2_atom_forge_frame_time (&self->forge, 0);
+		x_forge_object (&self->forge, &frame, 0, self->uris.patch_Set);
+
+		lv2_atom_forge_key (&self->forge, self->uris.patch_property);
+		lv2_atom_forge_urid (&self->forge, self->uris.bin_count);
+		lv2_atom_forge_key (&self->forge, self->uris.patch_value);
+		lv2_atom_forge_int (&self->forge, n_bins);
+
+		lv2_atom_forge_pop (&self->forge, &frame);
+	}
+
 	lv2_atom_forge_frame_time (&self->forge, 0);
 
 	/* add vector of floats raw 'bin_data' */
@@ -236,30 +1269,232 @@ tx_to_gui (ModSpectre* self, const float* bins, int32_t n_bins)
 	lv2_atom_forge_vector (&self->forge, sizeof (float), self->uris.atom_Float, n_bins, bins);
 
 	lv2_atom_forge_pop (&self->forge, &frame);
+}
+
+static void
+tx_code_to_gui (ModSpectre* self, const int32_t* code, uint32_t n_words)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time (&self->forge, 0);
 
-#if 0 // not used by UI
-	/* add integer attribute 'N_BINS' */
+	/* add vector of ints, encoded 'bin_code' */
 	x_forge_object (&self->forge, &frame, 0, self->uris.patch_Set);
 
 	lv2_atom_forge_key (&self->forge, self->uris.patch_property);
-	lv2_atom_forge_urid (&self->forge, self->uris.bin_count);
+	lv2_atom_forge_urid (&self->forge, self->uris.bin_code);
 	lv2_atom_forge_key (&self->forge, self->uris.patch_value);
-	lv2_atom_forge_int (&self->forge, n_bins);
+	lv2_atom_forge_vector (&self->forge, sizeof (int32_t), self->uris.atom_Int, n_words, code);
+
+	lv2_atom_forge_pop (&self->forge, &frame);
+}
+
+/* multichannel variants: all traces in a single object
+ * [ a spectrum ; bin_count n_cols ; bin_traces n_traces ; bin_data | bin_code <vector> ]
+ */
+static void
+tx_spectrum_to_gui (ModSpectre* self, SpectrumFrame const* f, LV2_URID key, LV2_URID type, uint32_t n, const void* data)
+{
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time (&self->forge, 0);
+
+	x_forge_object (&self->forge, &frame, 0, self->uris.spectrum);
+
+	lv2_atom_forge_key (&self->forge, self->uris.bin_count);
+	lv2_atom_forge_int (&self->forge, f->n_cols);
+	lv2_atom_forge_key (&self->forge, self->uris.bin_traces);
+	lv2_atom_forge_int (&self->forge, f->n_traces);
+	lv2_atom_forge_key (&self->forge, key);
+	lv2_atom_forge_vector (&self->forge, 4 /* float or int32_t */, type, n, data);
 
 	lv2_atom_forge_pop (&self->forge, &frame);
+}
+
+/* with_count: also send the mono variant's column count */
+static void
+tx_bins (ModSpectre* self, SpectrumFrame const* f, bool with_count)
+{
+	if (self->n_ch > 1) {
+		tx_spectrum_to_gui (self, f, self->uris.bin_data, self->uris.atom_Float, f->n_cols * f->n_traces, sf_bins (f));
+	} else {
+		tx_to_gui (self, sf_bins (f), f->n_cols, with_count);
+	}
+}
+
+static void
+tx_code (ModSpectre* self, SpectrumFrame const* f, const int32_t* code, uint32_t n_words)
+{
+	if (self->n_ch > 1) {
+		tx_spectrum_to_gui (self, f, self->uris.bin_code, self->uris.atom_Int, n_words, code);
+	} else {
+		tx_code_to_gui (self, code, n_words);
+	}
+}
+
+/* send the frame, unless nothing changed since the last one that was sent */
+static void
+tx_frame (ModSpectre* self, SpectrumFrame const* f)
+{
+	/* deltas are relative to the previous frame */
+	const bool complete = f->seq != self->tx_seq + 1
+	                      || f->n_cols != self->tx_cols
+	                      || f->n_traces != self->tx_traces
+	                      || f->encoding != self->tx_encoding;
+
+	self->tx_seq      = f->seq;
+	self->tx_cols     = f->n_cols;
+	self->tx_traces   = f->n_traces;
+	self->tx_encoding = f->encoding;
+
+	if (f->encoding == BC_FLOAT) {
+		/* column count: after a change or a gap, and periodically
+		 * with keyframes for GUIs that (re)connect later */
+		if (f->changed || complete) {
+			tx_bins (self, f, complete || f->keyframe);
+		}
+	} else if (complete || f->keyframe || (f->changed && f->n_delta == 0)) {
+		tx_code (self, f, sf_key (f), f->n_key);
+	} else if (f->changed) {
+		tx_code (self, f, sf_delta (f), f->n_delta);
+	}
+}
+
+#ifdef WITH_STATS
+/* *****************************************************************************
+ * Instrumentation
+ */
+
+static void
+tx_stat_hist (ModSpectre* self, LV2_URID key, st_hist const* cur, st_hist const* prev)
+{
+	int32_t h[ST_BUCKETS];
+	st_hist_diff (cur, prev, h);
+	lv2_atom_forge_key (&self->forge, key);
+	lv2_atom_forge_vector (&self->forge, sizeof (int32_t), self->uris.atom_Int, ST_BUCKETS, h);
+}
+
+/* counts since the previous report
+ * [ a stats ; stat_period <sec> ;
+ *   stat_frames, stat_lost (frames not sent) ; stat_skipped, stat_dropped (samples) ;
+ *   stat_worker, stat_latency, stat_run [usec], stat_backlog [samples] <log2 histogram> ]
+ */
+static void
+tx_stats (ModSpectre* self, StatSnapshot const* cur, float period)
+{
+	StatSnapshot const*  prev = &self->st_prev;
+	LV2_Atom_Forge_Frame frame;
+	lv2_atom_forge_frame_time (&self->forge, 0);
+
+	x_forge_object (&self->forge, &frame, 0, self->uris.stats);
+
+	lv2_atom_forge_key (&self->forge, self->uris.stat_period);
+	lv2_atom_forge_float (&self->forge, period);
+	lv2_atom_forge_key (&self->forge, self->uris.stat_frames);
+	lv2_atom_forge_int (&self->forge, cur->frames - prev->frames);
+	lv2_atom_forge_key (&self->forge, self->uris.stat_lost);
+	lv2_atom_forge_int (&self->forge, cur->lost - prev->lost);
+	lv2_atom_forge_key (&self->forge, self->uris.stat_skipped);
+	lv2_atom_forge_int (&self->forge, cur->skipped - prev->skipped);
+	lv2_atom_forge_key (&self->forge, self->uris.stat_dropped);
+	lv2_atom_forge_int (&self->forge, cur->dropped - prev->dropped);
+
+	tx_stat_hist (self, self->uris.stat_worker, &cur->worker, &prev->worker);
+	tx_stat_hist (self, self->uris.stat_latency, &cur->latency, &prev->latency);
+	tx_stat_hist (self, self->uris.stat_run, &cur->run, &prev->run);
+	tx_stat_hist (self, self->uris.stat_backlog, &cur->backlog, &prev->backlog);
+
+	lv2_atom_forge_pop (&self->forge, &frame);
+}
+
+/* update output ports and send stats, called from run() every STATS_INTERVAL */
+static void
+st_report (ModSpectre* self, double rate_in)
+{
+	StatSnapshot cur;
+	cur.frames = _st_get (self->st_frames);
+	cur.lost   = _st_get (self->st_lost);
+#ifdef BACKGROUND_FFT
+	cur.skipped = _st_get (self->n_skipped);
+	cur.dropped = _st_get (self->n_dropped);
+#else
+	cur.skipped = cur.dropped = 0;
 #endif
+	st_hist_get (&self->st_worker, &cur.worker);
+	st_hist_get (&self->st_backlog, &cur.backlog);
+	st_hist_get (&self->st_latency, &cur.latency);
+	st_hist_get (&self->st_run, &cur.run);
+
+	StatSnapshot const* prev   = &self->st_prev;
+	const float         period = self->st_elapsed / rate_in;
+
+	self->st_value[PS_FPS]     = (cur.frames - prev->frames) / period;
+	self->st_value[PS_LATENCY] = st_hist_mean (&cur.latency, &prev->latency) / 1000.f;
+	self->st_value[PS_WORKER]  = st_hist_mean (&cur.worker, &prev->worker) / 1000.f;
+	self->st_value[PS_LOAD]    = (cur.run.sum - prev->run.sum) / (period * 1e4f); // usec -> %
+	self->st_value[PS_SKIPPED] = 100.f * (uint32_t)(cur.skipped - prev->skipped + cur.dropped - prev->dropped) / self->st_elapsed;
+
+	if (self->ctrl_out) {
+		tx_stats (self, &cur, period);
+	}
+
+	self->st_prev    = cur;
+	self->st_elapsed = 0;
+}
+
+#ifdef BACKGROUND_FFT
+/* remember when samples arrived, and if a new frame was fetched, the
+ * time since the last sample that it includes was passed to run().
+ */
+static void
+st_track (ModSpectre* self, uint64_t now, SpectrumFrame const* f)
+{
+	const uint32_t w = self->st_ring_w;
+	self->st_ring[w % STATS_RING].pos = ob_write_pos (self->to_fft[0]);
+	self->st_ring[w % STATS_RING].t   = now;
+	self->st_ring_w = w + 1;
+
+	if (!f) {
+		return;
+	}
+	uint64_t t = now;
+	for (uint32_t i = 0; i < STATS_RING && i <= w; ++i) {
+		const uint32_t k = (w - i) % STATS_RING;
+		if ((int32_t)(self->st_ring[k].pos - f->pos) < 0) {
+			break;
+		}
+		t = self->st_ring[k].t;
+	}
+	st_hist_add (&self->st_latency, (now - t) / 1000);
 }
+#endif
+
+static uint32_t
+stats_port (ModSpectre const* self)
+{
+	return P_LAST + (self->n_ch > 1 ? self->n_ch - 1 + PM_LAST : 0);
+}
+#endif
 
 /* *****************************************************************************
  * LV2 Plugin
  */
 
+static void cleanup (LV2_Handle instance);
+
 static LV2_Handle
 instantiate (const LV2_Descriptor*     descriptor,
              double                    rate,
              const char*               bundle_path,
              const LV2_Feature* const* features)
 {
+	uint32_t n_ch = 1;
+	if (!strcmp (descriptor->URI, MODSPECTRE_URI "#stereo")) {
+		n_ch = 2;
+	} else if (!strcmp (descriptor->URI, MODSPECTRE_URI "#multi4")) {
+		n_ch = 4;
+	} else if (!strcmp (descriptor->URI, MODSPECTRE_URI "#multi8")) {
+		n_ch = 8;
+	}
+
 	ModSpectre* self = (ModSpectre*)calloc (1, sizeof (ModSpectre));
 
 	LV2_URID_Map* map = NULL;
@@ -267,6 +1502,11 @@ instantiate (const LV2_Descriptor*     descriptor,
 		if (!strcmp (features[i]->URI, LV2_URID__map)) {
 			map = (LV2_URID_Map*)features[i]->data;
 		}
+#ifdef BACKGROUND_FFT
+		else if (!strcmp (features[i]->URI, LV2_WORKER__schedule)) {
+			self->schedule = (LV2_Worker_Schedule*)features[i]->data;
+		}
+#endif
 	}
 
 	if (!map) {
@@ -277,35 +1517,128 @@ instantiate (const LV2_Descriptor*     descriptor,
 	lv2_atom_forge_init (&self->forge, map);
 	map_uris (map, &self->uris);
 
-	int fft_size = N_BINS * 16;
-
-	self->rate = rate;
-	self->fftx = (struct FFTAnalysis*) calloc(1, sizeof(struct FFTAnalysis));
-	fftx_init(self->fftx, fft_size, rate, 30 /*fps*/);
+	self->decim = (struct HBCascade*)malloc (n_ch * sizeof (struct HBCascade));
+	if (!self->decim) {
+		cleanup ((LV2_Handle)self);
+		return NULL;
+	}
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		self->rate = hbc_init (&self->decim[c], rate);
+	}
+	self->n_ch     = n_ch;
+	self->n_pairs  = n_ch / 2;
+	self->n_traces = n_ch;
+	self->n_max    = N_BINS * calc_traces (n_ch, true, true);
+	self->fft_sel  = 2; // 4096
+	self->n_cols_req = self->n_cols = N_BINS < 256 ? N_BINS : 256;
+	self->encoding_req = BC_FLOAT;
+
+	self->bins = (float*)calloc (self->n_max, sizeof (float));
+	self->last = (float*)malloc (self->n_max * sizeof (float));
+	self->bin_db = (float*)malloc ((FFT_MAX / 2 + 1) * sizeof (float));
+	if (!self->bins || !self->last || !self->bin_db) {
+		cleanup ((LV2_Handle)self);
+		return NULL;
+	}
+	if (self->n_pairs > 0) {
+		self->xcorr    = (float*)calloc (3 * N_BINS * self->n_pairs, sizeof (float));
+		self->pair_buf = (float*)malloc (FFT_MAX * sizeof (float));
+		if (!self->xcorr || !self->pair_buf) {
+			cleanup ((LV2_Handle)self);
+			return NULL;
+		}
+	}
 
-	self->resp = 0.f;
-	self->tc = 1.f;
+	/* plan all sizes and engines here, apply_config() only switches
+	 * between them: planning may measure and write the wisdom file,
+	 * which must not stall the analysis (or run()) */
+	for (int i = 0; i < FFT_SIZES; ++i) {
+		if (!fft_get (self, i)
+		    || fftx_set_phase (self->fft[i], true)
+		    || (n_ch == 1 && !cq_get (self, i))) {
+			cleanup ((LV2_Handle)self);
+			return NULL;
+		}
+	}
+	self->fftx = self->fft[self->fft_sel];
+
+	self->resp = self->resp_req = 1.f;
+	self->hop  = calc_hop (self->rate, 30, 0, self->fftx ? self->fftx->window_size : 4096);
+	self->tc   = expf (-2.0 * M_PI * self->resp * self->hop / self->rate);
+	self->key_interval = ceil (KEYFRAME_INTERVAL * self->rate / self->hop);
+	self->corr_a = 1.f - expf (-(double)self->hop / (CORRELATION_TIME * self->rate));
+	self->mode = 1;
+	self->p_resp = self->p_fps = self->p_overlap = -1;
+	self->p_sel = -1;
+
+	if (!self->fftx
+	    || bm_init (&self->binmap, N_BINS)
+	    || bm_build (&self->binmap, self->n_cols, fftx_bins (self->fftx), self->fftx->freq_per_bin, BM_PEAK)) {
+		cleanup ((LV2_Handle)self);
+		return NULL;
+	}
 
-	for (uint32_t b = 0; b < N_BINS; ++b) {
+	for (uint32_t b = 0; b < self->n_max; ++b) {
 		self->last[b] = -1;
 	}
 
 #ifdef BACKGROUND_FFT
-	pthread_mutex_init (&self->lock, NULL);
-	pthread_cond_init (&self->signal, NULL);
-
-	self->to_fft = rb_alloc (fft_size * 8);
-	self->result = rb_alloc (32);
-	self->keep_running = true;
-	if (pthread_create (&self->thread, NULL, worker, self)) {
-		pthread_mutex_destroy (&self->lock);
-		pthread_cond_destroy (&self->signal);
-		rb_free (self->to_fft);
-		rb_free (self->result);
-		fftx_free(self->fftx);
-		free (self);
+	/* prefer the host's worker, the thread-pool is a fallback */
+	if (!self->schedule) {
+		if (wp_init ()) {
+			cleanup ((LV2_Handle)self);
+			return NULL;
+		}
+		self->pool = true;
+	}
+
+	/* buffers are at the input rate */
+	const uint32_t dec = hbc_factor (&self->decim[0]);
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		self->to_fft[c] = ob_alloc (FFT_MAX * 4 * dec);
+		self->a_in[c]   = (float*) malloc (FFT_MAX * dec * sizeof (float));
+		if (!self->to_fft[c] || !self->a_in[c]) {
+			cleanup ((LV2_Handle)self);
+			return NULL;
+		}
+	}
+	self->result = tb_alloc (sf_size (self->n_max));
+	if (!self->result) {
+		cleanup ((LV2_Handle)self);
 		return NULL;
 	}
+	self->frame_due = self->hop * dec;
+	self->woken_at  = 0;
+	self->loud_at   = -SILENCE_HOLD;
+	self->loud_wp   = 0;
+	self->scanned   = 0;
+#ifdef RECORDER
+	self->rec = rec_create (self->n_max, n_ch);
+#endif
+	if (self->pool) {
+		wp_add (&self->task, worker, self);
+	}
+#else
+	self->result = (SpectrumFrame*)calloc (1, sf_size (self->n_max));
+	if (!self->result) {
+		cleanup ((LV2_Handle)self);
+		return NULL;
+	}
+#endif
+
+#ifdef SHM_EXPORT
+	if (shm_enabled ()) {
+		/* names are unique per process, unless the same
+		 * segment is left over from a crashed process with
+		 * the same pid, or a 2nd copy of the plugin is loaded */
+		static uint32_t shm_id = 0;
+		for (int i = 0; i < 16 && !self->shm; ++i) {
+			self->shm = mss_create (__atomic_fetch_add (&shm_id, 1, __ATOMIC_RELAXED), self->n_max, n_ch);
+		}
+		if (!self->shm) {
+			fprintf (stderr, "modspectre.lv2: cannot create shared memory export\n");
+		}
+	}
 #endif
 	return (LV2_Handle)self;
 }
@@ -319,9 +1652,77 @@ connect_port (LV2_Handle instance,
 	if (port == P_NOTIFY) {
 		self->ctrl_out = (LV2_Atom_Sequence*) data;
 	}
+	else if (port == P_AIN) {
+		self->ain[0] = (float const*)data;
+	}
 	else if (port < P_LAST) {
 		self->ports[port] = (float*)data;
 	}
+	else if (port < P_LAST + self->n_ch - 1) {
+		self->ain[port - P_LAST + 1] = (float const*)data;
+	}
+	else if (self->n_ch > 1 && port < P_LAST + self->n_ch - 1 + PM_LAST) {
+		self->ports_multi[port - P_LAST - self->n_ch + 1] = (float*)data;
+	}
+#ifdef WITH_STATS
+	else if (port >= stats_port (self) && port < stats_port (self) + PS_LAST) {
+		self->ports_stats[port - stats_port (self)] = (float*)data;
+	}
+#endif
+}
+
+/* map control port values to the analysis configuration */
+static void
+read_ports (ModSpectre* self)
+{
+	if (self->p_resp != *self->ports[P_RESPONSE]) {
+		self->p_resp = *self->ports[P_RESPONSE];
+		float v = self->p_resp;
+		if (v < 0.01) v = 0.01;
+		if (v > 10.0) v = 10.0;
+		self->resp_req = v;
+	}
+
+	self->mode = rintf (*self->ports[P_MODE]);
+	if (self->mode < 0) self->mode = 0;
+	if (self->mode > 4) self->mode = 4;
+
+	/* FFT size: power of two, 1024 .. 32768 */
+	int sel = ilogbf (fmaxf (1.f, *self->ports[P_FFTSIZE])) - FFT_MIN_LOG2;
+	if (sel < 0) sel = 0;
+	if (sel >= FFT_SIZES) sel = FFT_SIZES - 1;
+	self->fft_sel = sel;
+
+	if (self->p_fps != *self->ports[P_FPS] || self->p_overlap != *self->ports[P_OVERLAP] || self->p_sel != sel) {
+		self->p_fps     = *self->ports[P_FPS];
+		self->p_overlap = *self->ports[P_OVERLAP];
+		self->p_sel     = sel;
+		float fps = self->p_fps;
+		float ovl = self->p_overlap;
+		if (fps < 1.f) fps = 1.f;
+		if (fps > 60.f) fps = 60.f;
+		if (ovl < 0.f) ovl = 0.f;
+		if (ovl > .875f) ovl = .875f;
+		self->hop = calc_hop (self->rate, fps, ovl, 1 << (FFT_MIN_LOG2 + sel));
+	}
+
+	int n_cols = rintf (*self->ports[P_COLUMNS]);
+	if (n_cols < MIN_COLS) n_cols = MIN_COLS;
+	if (n_cols > N_BINS) n_cols = N_BINS;
+	self->n_cols_req = n_cols;
+
+	int enc = rintf (*self->ports[P_ENCODING]);
+	if (enc < BC_FLOAT) enc = BC_FLOAT;
+	if (enc > BC_8BIT) enc = BC_8BIT;
+	self->encoding_req = (bincode_t)enc;
+
+	/* constant-Q is only available for the mono variant */
+	self->engine_req = self->n_ch == 1 && rintf (*self->ports[P_ENGINE]) == E_CQT ? E_CQT : E_FFT;
+
+	if (self->n_ch > 1) {
+		self->midside_req = *self->ports_multi[PM_MIDSIDE] > 0.5f;
+		self->corr_req    = *self->ports_multi[PM_CORRELATION] > 0.5f;
+	}
 }
 
 static void
@@ -331,6 +1732,9 @@ run (LV2_Handle instance, uint32_t n_samples)
 	if (n_samples == 0) {
 		return;
 	}
+#ifdef WITH_STATS
+	const uint64_t t_start = st_now ();
+#endif
 	if (self->ctrl_out) {
 		/* prepare forge buffer and initialize atom-sequence */
 		const uint32_t capacity = self->ctrl_out->atom.size;
@@ -338,50 +1742,57 @@ run (LV2_Handle instance, uint32_t n_samples)
 		lv2_atom_forge_sequence_head (&self->forge, &self->frame, 0);
 	}
 
-	float const* const a_in = self->ports[P_AIN];
 	bool fft_ran_this_cycle = false;
 
-	if (self->resp != *self->ports[P_RESPONSE]) {
-		self->resp = *self->ports[P_RESPONSE];
-		float v = self->resp;
-		if (v < 0.01) v = 0.01;
-		if (v > 10.0) v = 10.0;
-		self->tc = expf (-2.0 * M_PI * v / 30);
-	}
+	read_ports (self);
 
 #ifdef BACKGROUND_FFT
-	float tbl[N_BINS];
-	feed_fft (self, a_in, n_samples);
-	fft_ran_this_cycle = rb_read_space (self->result) > 0;
-	if (fft_ran_this_cycle) {
-		float ignore = 0;
-		while (0 == rb_read_one (self->result, &ignore)) ;
-	}
-	memcpy (tbl, self->bins, sizeof (float) * N_BINS); // XXX not atomic
+	feed_fft (self, n_samples);
+	fft_ran_this_cycle = tb_fetch (self->result);
+	SpectrumFrame const* frame = (SpectrumFrame const*) tb_front (self->result);
+#ifdef WITH_STATS
+	st_track (self, t_start, fft_ran_this_cycle ? frame : NULL);
+#endif
 #else
-	fft_ran_this_cycle = 0 == fftx_run(self->fftx, n_samples, a_in);
+	apply_config (self);
+	fft_ran_this_cycle = analyze (self, n_samples);
 	if (fft_ran_this_cycle) {
 		assign_bins (self);
+		prepare_frame (self, self->result);
+#ifdef SHM_EXPORT
+		shm_export (self);
+#endif
+#ifdef WITH_STATS
+		st_add (&self->st_frames, 1);
+		st_hist_add (&self->st_worker, (st_now () - t_start) / 1000);
+#endif
+	}
+	SpectrumFrame const* frame = self->result;
+#endif
+
+#ifdef WITH_STATS
+	const double rate_in = self->rate * hbc_factor (&self->decim[0]);
+	self->st_elapsed += n_samples;
+	if (self->st_elapsed >= STATS_INTERVAL * rate_in) {
+		st_report (self, rate_in);
+	}
+	for (uint32_t i = 0; i < PS_LAST; ++i) {
+		if (self->ports_stats[i]) {
+			*self->ports_stats[i] = self->st_value[i];
+		}
 	}
-	float *tbl = self->bins;
 #endif
 
 	if (self->ctrl_out) {
 		if (fft_ran_this_cycle) {
-			bool changed = false;
-			for (uint32_t b = 0; b < N_BINS; ++b) {
-				if (fabsf (self->last[b] - tbl[b]) >= guipx) {
-					self->last[b] = tbl[b];
-					changed = true;
-				}
-			}
-			if (changed) {
-				tx_to_gui (self, self->last, N_BINS);
-			}
+			tx_frame (self, frame);
 		}
 		/* close off atom-sequence */
 		lv2_atom_forge_pop (&self->forge, &self->frame);
 	}
+#ifdef WITH_STATS
+	st_hist_add (&self->st_run, (st_now () - t_start) / 1000);
+#endif
 }
 
 static void
@@ -389,37 +1800,123 @@ cleanup (LV2_Handle instance)
 {
 	ModSpectre* self = (ModSpectre*)instance;
 #ifdef BACKGROUND_FFT
-	pthread_mutex_lock (&self->lock);
-	self->keep_running = false;
-	pthread_cond_signal (&self->signal);
-	pthread_mutex_unlock (&self->lock);
-	pthread_join (self->thread, NULL);
-
-	pthread_mutex_destroy (&self->lock);
-	pthread_cond_destroy (&self->signal);
-	rb_free (self->to_fft);
-	rb_free (self->result);
-#endif
-	fftx_free(self->fftx);
+	if (self->pool) {
+		wp_remove (&self->task);
+		wp_fini ();
+	}
+	for (uint32_t c = 0; c < self->n_ch; ++c) {
+		if (self->to_fft[c]) {
+			ob_free (self->to_fft[c]);
+		}
+		free (self->a_in[c]);
+	}
+	if (self->result) {
+		tb_free (self->result);
+	}
+#ifdef RECORDER
+	sr_destroy (self->rec);
+#endif
+#else
+	free (self->result);
+#endif
+#ifdef SHM_EXPORT
+	mss_destroy (self->shm);
+#endif
+	free (self->decim);
+	free (self->bins);
+	free (self->last);
+	free (self->xcorr);
+	free (self->pair_buf);
+	free (self->bin_db);
+	bm_free (&self->binmap);
+	for (int i = 0; i < FFT_SIZES; ++i) {
+		if (self->fft[i]) {
+			fftx_free (self->fft[i]);
+		}
+		cq_free (self->cq[i]);
+	}
 	free (instance);
 }
 
+#ifdef BACKGROUND_FFT
+/* *****************************************************************************
+ * LV2 worker
+ */
+
+static LV2_Worker_Status
+work (LV2_Handle                  instance,
+      LV2_Worker_Respond_Function respond,
+      LV2_Worker_Respond_Handle   handle,
+      uint32_t                    size,
+      const void*                 data)
+{
+	ModSpectre*    self = (ModSpectre*)instance;
+	const uint64_t fp   = wp_denormals ();
+	worker (self);
+	wp_fp_restore (fp);
+
+	/* frames are passed on via the triple-buffer, only run() can
+	 * send them. The response allows to schedule the next job. */
+	if (respond (handle, 0, NULL) != LV2_WORKER_SUCCESS) {
+		__atomic_store_n (&self->job, 0, __ATOMIC_RELEASE);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+work_response (LV2_Handle  instance,
+               uint32_t    size,
+               const void* data)
+{
+	ModSpectre* self = (ModSpectre*)instance;
+	self->job        = 0;
+	return LV2_WORKER_SUCCESS;
+}
+
+/* hosts deliver responses after run(), start a job that run()
+ * had to defer, rather than waiting for the next cycle */
+static LV2_Worker_Status
+end_run (LV2_Handle instance)
+{
+	ModSpectre* self = (ModSpectre*)instance;
+	if (self->job_deferred && !self->job) {
+		self->job_deferred = false;
+		if (submit (self)) {
+			self->woken_at = ob_write_pos (self->to_fft[0]);
+		}
+	}
+	return LV2_WORKER_SUCCESS;
+}
+#endif
+
 static const void*
 extension_data (const char* uri)
 {
+#ifdef BACKGROUND_FFT
+	static const LV2_Worker_Interface worker_iface = { work, work_response, end_run };
+	if (!strcmp (uri, LV2_WORKER__interface)) {
+		return &worker_iface;
+	}
+#endif
 	return NULL;
 }
 
-static const LV2_Descriptor descriptor = {
-	MODSPECTRE_URI,
-	instantiate,
-	connect_port,
-	NULL,
-	run,
-	NULL,
-	cleanup,
-	extension_data
-};
+#define mkdesc(ID, URI)                      \
+	static const LV2_Descriptor descriptor##ID = { \
+		URI,                                       \
+		instantiate,                               \
+		connect_port,                              \
+		NULL,                                      \
+		run,                                       \
+		NULL,                                      \
+		cleanup,                                   \
+		extension_data                             \
+	};
+
+mkdesc (0, MODSPECTRE_URI)
+mkdesc (1, MODSPECTRE_URI "#stereo")
+mkdesc (2, MODSPECTRE_URI "#multi4")
+mkdesc (3, MODSPECTRE_URI "#multi8")
 
 #undef LV2_SYMBOL_EXPORT
 #ifdef _WIN32
@@ -433,7 +1930,13 @@ lv2_descriptor (uint32_t index)
 {
 	switch (index) {
 	case 0:
-		return &descriptor;
+		return &descriptor0;
+	case 1:
+		return &descriptor1;
+	case 2:
+		return &descriptor2;
+	case 3:
+		return &descriptor3;
 	default:
 		return NULL;
 	}
@@ -24,6 +24,7 @@
 
 #define _atomic_int_get(P)    __atomic_load_4 (&(P), __ATOMIC_SEQ_CST)
 #define _atomic_int_set(P, V) __atomic_store_4 (&(P), (V), __ATOMIC_SEQ_CST)
+#define _atomic_read_fence()  __atomic_thread_fence (__ATOMIC_ACQUIRE)
 
 #define adef uint32_t
 #define avar uint32_t
@@ -32,6 +33,7 @@
 
 #define _atomic_int_set(P,V) __sync_lock_test_and_set (&(P), (V))
 #define _atomic_int_get(P)   __sync_add_and_fetch (&(P), 0)
+#define _atomic_read_fence() __sync_synchronize ()
 #define adef volatile uint32_t
 #define avar uint32_t
 
@@ -41,6 +43,7 @@
 
 #define _atomic_int_set(P,V) P = (V)
 #define _atomic_int_get(P) P
+#define _atomic_read_fence()
 #define adef size_t
 #define avar size_t
 
@@ -139,3 +142,109 @@ static void rb_read_clear(ringbuf *rb) {
 	avar wp = _atomic_int_get (rb->wp);
 	_atomic_int_set (rb->rp, wp);
 }
+
+/* overwriting ringbuffer: the writer never fails, and always keeps the
+ * most recent data. The reader keeps its own position and detects if
+ * data was overwritten before it could be read.
+ *
+ * To allow for a concurrent write, only len / 2 samples are readable,
+ * and the writer publishes at most len / 2 samples at a time.
+ */
+
+typedef struct {
+	float* data;
+	adef wp; // total samples written, wraps around
+	size_t len;
+	size_t mask;
+} ovbuf;
+
+/* returns NULL if allocation fails */
+static ovbuf* ob_alloc (size_t siz) {
+	ovbuf* ob = (ovbuf*) malloc (sizeof (ovbuf));
+	if (!ob) {
+		return NULL;
+	}
+	size_t power_of_two;
+	for (power_of_two = 1; 1U << power_of_two < siz; ++power_of_two);
+	ob->len = 1 << power_of_two;
+	ob->mask = ob->len -1;
+	_atomic_int_set (ob->wp, 0);
+	ob->data = (float*) calloc (ob->len, sizeof(float));
+	if (!ob->data) {
+		free (ob);
+		return NULL;
+	}
+	return ob;
+}
+
+static void ob_free (ovbuf *ob) {
+	free (ob->data);
+	free (ob);
+}
+
+/* max samples that can be read without risk of being overwritten */
+static size_t ob_read_max (ovbuf* ob) {
+	return ob->len / 2;
+}
+
+/* may exceed ob_read_max() in case of overrun */
+static size_t ob_read_space (ovbuf* ob, avar rp) {
+	avar w = _atomic_int_get (ob->wp);
+	return (avar)(w - rp);
+}
+
+/* total number of samples written, wraps around */
+static avar ob_write_pos (ovbuf* ob) {
+	return _atomic_int_get (ob->wp);
+}
+
+/* set read-position to the most recent 'len' samples */
+static void ob_read_latest (ovbuf* ob, avar* rp, size_t len) {
+	avar w = _atomic_int_get (ob->wp);
+	*rp = w - len;
+}
+
+/* returns -1 if data was overwritten while reading */
+static int ob_read (ovbuf* ob, avar* rp, float* data, size_t len) {
+	const size_t p = *rp & ob->mask;
+	if (p + len <= ob->len) {
+		memcpy ((void*)data, (void*)&ob->data[p], len * sizeof (float));
+	} else {
+		const size_t part = ob->len - p;
+		const size_t remn = len - part;
+		memcpy ((void*) data,        (void*) &ob->data[p], part * sizeof (float));
+		memcpy ((void*) &data[part], (void*) ob->data,     remn * sizeof (float));
+	}
+	/* check the write-position only after the copy completed */
+	_atomic_read_fence ();
+	if (ob_read_space (ob, *rp) > ob_read_max (ob)) {
+		return -1;
+	}
+	*rp += len;
+	return 0;
+}
+
+static void ob_write (ovbuf* ob, const float* data, size_t len) {
+	if (len > ob->len) {
+		data += len - ob->len;
+		len = ob->len;
+	}
+	/* a concurrent ob_read() only notices an overwrite once it is
+	 * published, which must not reach more than len / 2 ahead */
+	while (len > 0) {
+		const size_t n = len > ob->len / 2 ? ob->len / 2 : len;
+		avar w = _atomic_int_get (ob->wp);
+		const size_t p = w & ob->mask;
+		if (p + n <= ob->len) {
+			memcpy ((void*) &ob->data[p], (void*) data, n * sizeof (float));
+		} else {
+			const size_t part = ob->len - p;
+			const size_t remn = n - part;
+			memcpy ((void*) &ob->data[p], (void*) data,        part * sizeof (float));
+			memcpy ((void*) ob->data,     (void*) &data[part], remn * sizeof (float));
+		}
+		_atomic_int_set (ob->wp, w + n);
+		data += n;
+		len  -= n;
+	}
+}
@@ -0,0 +1,218 @@
+/*
+ *  Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Export of the most recent analysis frame to a POSIX shared memory
+ * segment "/x42-modspectre-<pid>-<n>", one per plugin instance.
+ *
+ * The frame is protected by a sequence lock: the (single) writer makes
+ * 'seq' odd while it updates the frame, and even again when done.
+ * Readers copy the frame and retry if 'seq' was odd or changed in the
+ * meantime. Readers never block the writer and need no syscalls after
+ * mapping the segment.
+ *
+ * This header is used by the plugin (writer) and by readers, see
+ * tools/modspectre-shm.c. A reader only needs mss_open(), mss_read()
+ * and mss_close().
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined __ATOMIC_SEQ_CST
+#error shared memory export requires __atomic builtins
+#endif
+
+#define MSS_MAGIC   0x5353534d // "MSSS"
+#define MSS_VERSION 1
+#define MSS_PREFIX  "/x42-modspectre-"
+
+/* mss_frame.flags, traces in addition to the n_channels input channels */
+#define MSS_MIDSIDE     1 // mid, side for every channel pair
+#define MSS_CORRELATION 2 // phase correlation for every channel pair, 0..1 = -1..+1
+
+/* per frame metadata, protected by the seqlock */
+typedef struct {
+	uint64_t frame;    // frames published since instantiation
+	uint64_t time_ns;  // CLOCK_MONOTONIC when the frame was published
+	double   rate;     // analysis sample-rate
+	uint32_t fft_size; // 0: constant-Q
+	uint32_t n_cols;   // display columns per trace, 20Hz .. 20kHz log-scale
+	uint32_t n_traces; // channels, [mid, side]*, [correlation]*
+	uint32_t flags;    // MSS_MIDSIDE | MSS_CORRELATION
+} mss_frame;
+
+typedef struct {
+	/* constant after creation */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;       // segment size [bytes]
+	uint32_t n_max;      // capacity of data[]
+	int32_t  pid;        // process that owns the segment
+	uint32_t n_channels; // plugin variant
+	/* seqlock, odd while the writer updates the frame */
+	uint32_t seq;
+	uint32_t _pad;
+	mss_frame f;
+	float     data[]; // [f.n_traces * f.n_cols] trace after trace, 0..1 = -96..0dB
+} mss_segment;
+
+/* writer handle */
+typedef struct {
+	char         name[64];
+	mss_segment* s;
+} mss_export;
+
+/* frequency at the center of a column, same as the display */
+static inline double mss_freq_at_col (uint32_t n_cols, uint32_t c) {
+	return 20.0 * pow (1000.0, (c + .5) / n_cols);
+}
+
+/* ****************************************************************************
+ * writer
+ */
+
+/* not realtime safe. returns NULL on error */
+static mss_export* mss_create (uint32_t id, uint32_t n_max, uint32_t n_channels) {
+	mss_export* e = (mss_export*) calloc (1, sizeof (mss_export));
+	if (!e) {
+		return NULL;
+	}
+	snprintf (e->name, sizeof (e->name), MSS_PREFIX "%d-%u", (int)getpid (), id);
+
+	const size_t size = sizeof (mss_segment) + n_max * sizeof (float);
+	int fd = shm_open (e->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		free (e);
+		return NULL;
+	}
+	if (ftruncate (fd, size)) {
+		close (fd);
+		shm_unlink (e->name);
+		free (e);
+		return NULL;
+	}
+	void* m = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (m == MAP_FAILED) {
+		shm_unlink (e->name);
+		free (e);
+		return NULL;
+	}
+
+	e->s = (mss_segment*) m;
+	e->s->version    = MSS_VERSION;
+	e->s->size       = size;
+	e->s->n_max      = n_max;
+	e->s->pid        = getpid ();
+	e->s->n_channels = n_channels;
+	/* readers check the magic last */
+	__atomic_store_n (&e->s->magic, MSS_MAGIC, __ATOMIC_RELEASE);
+	return e;
+}
+
+static void mss_destroy (mss_export* e) {
+	if (!e) {
+		return;
+	}
+	munmap (e->s, e->s->size);
+	shm_unlink (e->name);
+	free (e);
+}
+
+/* publish a frame, wait-free. n_traces * n_cols <= n_max */
+static void mss_publish (mss_export* e, mss_frame const* f, float const* data) {
+	mss_segment* s = e->s;
+	const uint32_t seq = s->seq;
+	__atomic_store_n (&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	s->f = *f;
+	memcpy (s->data, data, f->n_traces * f->n_cols * sizeof (float));
+
+	__atomic_store_n (&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* ****************************************************************************
+ * reader
+ */
+
+/* map a segment read-only, name as listed in /dev/shm, with or without
+ * leading slash. returns NULL on error */
+static mss_segment const* mss_open (const char* name) {
+	char path[300];
+	snprintf (path, sizeof (path), "%s%s", name[0] == '/' ? "" : "/", name);
+	int fd = shm_open (path, O_RDONLY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat (fd, &st) || st.st_size < (off_t)sizeof (mss_segment)) {
+		close (fd);
+		return NULL;
+	}
+	void* m = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (m == MAP_FAILED) {
+		return NULL;
+	}
+	mss_segment const* s = (mss_segment const*) m;
+	if (__atomic_load_n (&s->magic, __ATOMIC_ACQUIRE) != MSS_MAGIC
+	    || s->version != MSS_VERSION || s->size != (uint64_t)st.st_size) {
+		munmap (m, st.st_size);
+		return NULL;
+	}
+	return s;
+}
+
+static void mss_close (mss_segment const* s) {
+	munmap ((void*)s, s->size);
+}
+
+/* copy the most recent frame.
+ * data: [capacity] floats, should be n_max.
+ * returns 0 on success, -1 if no frame was published yet or if the
+ * frame does not fit, and 1 if the writer was busy (retry).
+ */
+static int mss_read (mss_segment const* s, mss_frame* f, float* data, uint32_t capacity) {
+	const uint32_t seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1) {
+		return 1;
+	}
+	if (seq == 0) {
+		return -1;
+	}
+	*f = s->f;
+	const uint32_t n = f->n_traces * f->n_cols;
+	if (n <= capacity && n <= s->n_max) {
+		memcpy (data, s->data, n * sizeof (float));
+	}
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (__atomic_load_n (&s->seq, __ATOMIC_RELAXED) != seq) {
+		return 1;
+	}
+	return n <= capacity ? 0 : -1;
+}
@@ -0,0 +1,353 @@
+/*
+ *  Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Spectrogram recorder: a memory-mapped file of fixed size records.
+ *
+ * The file holds SR_LEVELS ring-buffers of equal record count. Level 0
+ * has every analyzed frame, the other levels combine 2, 4 and 16 frames
+ * using the max of every value, so the coarsest level spans 16 times
+ * the history of level 0.
+ *
+ * A single writer appends records, readers can map the same file
+ * concurrently. Every record carries its index, which is invalidated
+ * while the record is rewritten, so readers can detect records that
+ * were overwritten while they were copied.
+ *
+ * The writer may block on page-faults (disk I/O) and must not be
+ * used from a realtime thread. Readers only need sr_open(), sr_range(),
+ * sr_read() and sr_close(), see tools/modspectre-rec.c
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined __ATOMIC_SEQ_CST
+#error spectrum recorder requires __atomic builtins
+#endif
+
+#define SR_MAGIC       0x5253534d // "MSSR"
+#define SR_VERSION     1
+#define SR_LEVELS      4
+#define SR_HEADER_SIZE 4096
+#define SR_INVALID     UINT64_MAX
+
+/* sr_record.flags, same as mss_frame.flags */
+#define SR_MIDSIDE     1
+#define SR_CORRELATION 2
+
+/* frames per record of each level */
+static const uint32_t sr_factor[SR_LEVELS] = { 1, 2, 4, 16 };
+
+typedef struct {
+	uint64_t offset;    // of the first record [bytes]
+	uint64_t capacity;  // records
+	volatile uint64_t n_written; // records written since creation
+	uint32_t factor;
+	uint32_t _pad;
+} sr_level;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size; // [bytes] incl. sr_record
+	uint32_t n_max;       // capacity of sr_record.data[]
+	uint32_t n_channels;  // plugin variant
+	uint32_t n_levels;
+	sr_level level[SR_LEVELS];
+} sr_header;
+
+typedef struct {
+	volatile uint64_t index; // n_written at the time, SR_INVALID while writing
+	int64_t  time_ns;  // CLOCK_REALTIME of the first frame
+	double   rate;     // analysis sample-rate
+	uint32_t frame;    // sequence number of the first frame
+	uint32_t n_frames; // analyzed frames combined in this record
+	uint32_t fft_size; // 0: constant-Q
+	uint16_t n_cols;
+	uint8_t  n_traces;
+	uint8_t  flags;    // SR_MIDSIDE | SR_CORRELATION
+	uint16_t data[];   // [n_traces * n_cols] trace after trace, 0..65535 = -96..0dB
+} sr_record;
+
+/* ****************************************************************************
+ * writer
+ */
+
+typedef struct {
+	sr_record head;
+	float*    data;  // [n_max] max of all frames so far
+	uint32_t  count; // records of the level below
+} sr_acc;
+
+typedef struct {
+	uint8_t*   map;
+	size_t     size;
+	sr_header* h;
+	sr_acc     acc[SR_LEVELS]; // [0] is unused
+} sr_writer;
+
+/* create or truncate a recording of size bytes, not realtime safe.
+ * returns NULL on error */
+static sr_writer* sr_create (const char* path, size_t size, uint32_t n_max, uint32_t n_channels) {
+	const size_t rs  = (sizeof (sr_record) + n_max * sizeof (uint16_t) + 15) & ~15;
+	const size_t cap = size > SR_HEADER_SIZE ? (size - SR_HEADER_SIZE) / (SR_LEVELS * rs) : 0;
+	if (cap < 16) {
+		return NULL;
+	}
+	size = SR_HEADER_SIZE + SR_LEVELS * cap * rs;
+
+	sr_writer* w = (sr_writer*) calloc (1, sizeof (sr_writer));
+	if (!w) {
+		return NULL;
+	}
+	for (int l = 1; l < SR_LEVELS; ++l) {
+		if (!(w->acc[l].data = (float*) malloc (n_max * sizeof (float)))) {
+			goto fail;
+		}
+	}
+
+	int fd = open (path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0) {
+		goto fail;
+	}
+	if (ftruncate (fd, size)) {
+		close (fd);
+		goto fail;
+	}
+	void* m = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (m == MAP_FAILED) {
+		goto fail;
+	}
+
+	w->map  = (uint8_t*) m;
+	w->size = size;
+	w->h    = (sr_header*) m;
+	w->h->version     = SR_VERSION;
+	w->h->record_size = rs;
+	w->h->n_max       = n_max;
+	w->h->n_channels  = n_channels;
+	w->h->n_levels    = SR_LEVELS;
+	for (int l = 0; l < SR_LEVELS; ++l) {
+		w->h->level[l].offset    = SR_HEADER_SIZE + l * cap * rs;
+		w->h->level[l].capacity  = cap;
+		w->h->level[l].n_written = 0;
+		w->h->level[l].factor    = sr_factor[l];
+	}
+	__atomic_store_n (&w->h->magic, SR_MAGIC, __ATOMIC_RELEASE);
+	return w;
+
+fail:
+	for (int l = 1; l < SR_LEVELS; ++l) {
+		free (w->acc[l].data);
+	}
+	free (w);
+	return NULL;
+}
+
+/* the file is retained */
+static void sr_destroy (sr_writer* w) {
+	if (!w) {
+		return;
+	}
+	munmap (w->map, w->size);
+	for (int l = 1; l < SR_LEVELS; ++l) {
+		free (w->acc[l].data);
+	}
+	free (w);
+}
+
+static void sr_put (sr_writer* w, uint32_t l, sr_record const* head, float const* data) {
+	sr_level* const lv = &w->h->level[l];
+	const uint64_t  n  = lv->n_written;
+	sr_record*      r  = (sr_record*) &w->map[lv->offset + (n % lv->capacity) * w->h->record_size];
+
+	__atomic_store_n (&r->index, SR_INVALID, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	r->time_ns  = head->time_ns;
+	r->rate     = head->rate;
+	r->frame    = head->frame;
+	r->n_frames = head->n_frames;
+	r->fft_size = head->fft_size;
+	r->n_cols   = head->n_cols;
+	r->n_traces = head->n_traces;
+	r->flags    = head->flags;
+
+	const uint32_t n_val = head->n_cols * head->n_traces;
+	for (uint32_t i = 0; i < n_val; ++i) {
+		const float v = data[i];
+		r->data[i] = v <= 0.f ? 0 : v >= 1.f ? 65535 : (uint16_t)(v * 65535.f + .5f);
+	}
+
+	__atomic_store_n (&r->index, n, __ATOMIC_RELEASE);
+	__atomic_store_n (&lv->n_written, n + 1, __ATOMIC_RELEASE);
+}
+
+/* write a record to level l and accumulate it for the next level */
+static void sr_push (sr_writer* w, uint32_t l, sr_record const* head, float const* data) {
+	sr_put (w, l, head, data);
+	if (++l >= SR_LEVELS) {
+		return;
+	}
+
+	sr_acc* const  a     = &w->acc[l];
+	const uint32_t n_val = head->n_cols * head->n_traces;
+
+	/* flush a partial record when the layout changes */
+	if (a->count > 0 && (a->head.n_cols != head->n_cols || a->head.n_traces != head->n_traces)) {
+		a->count = 0;
+		sr_push (w, l, &a->head, a->data);
+	}
+
+	if (a->count == 0) {
+		a->head = *head;
+		memcpy (a->data, data, n_val * sizeof (float));
+	} else {
+		a->head.n_frames += head->n_frames;
+		for (uint32_t i = 0; i < n_val; ++i) {
+			a->data[i] = fmaxf (a->data[i], data[i]);
+		}
+	}
+
+	if (++a->count == sr_factor[l] / sr_factor[l - 1]) {
+		a->count = 0;
+		sr_push (w, l, &a->head, a->data);
+	}
+}
+
+/* append an analyzed frame.
+ * head: metadata, index, n_frames and time are set here.
+ * data: [n_traces * n_cols] 0..1 */
+static void sr_append (sr_writer* w, sr_record* head, float const* data) {
+	struct timespec ts;
+	clock_gettime (CLOCK_REALTIME, &ts);
+	head->time_ns  = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	head->n_frames = 1;
+	sr_push (w, 0, head, data);
+}
+
+/* ****************************************************************************
+ * reader
+ */
+
+typedef struct {
+	uint8_t const*   map;
+	size_t           size;
+	sr_header const* h;
+} sr_file;
+
+/* map a recording read-only. returns NULL on error */
+static sr_file* sr_open (const char* path) {
+	int fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat (fd, &st) || st.st_size < SR_HEADER_SIZE) {
+		close (fd);
+		return NULL;
+	}
+	void* m = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (m == MAP_FAILED) {
+		return NULL;
+	}
+	sr_header const* h = (sr_header const*) m;
+	bool ok = __atomic_load_n (&h->magic, __ATOMIC_ACQUIRE) == SR_MAGIC
+	          && h->version == SR_VERSION && h->n_levels == SR_LEVELS;
+	for (int l = 0; ok && l < SR_LEVELS; ++l) {
+		ok = h->level[l].offset + h->level[l].capacity * h->record_size <= (uint64_t)st.st_size;
+	}
+	sr_file* f = ok ? (sr_file*) malloc (sizeof (sr_file)) : NULL;
+	if (!f) {
+		munmap (m, st.st_size);
+		return NULL;
+	}
+	f->map  = (uint8_t const*) m;
+	f->size = st.st_size;
+	f->h    = h;
+	return f;
+}
+
+static void sr_close (sr_file* f) {
+	munmap ((void*)f->map, f->size);
+	free (f);
+}
+
+/* records [*first, *end) of level l that are currently available */
+static void sr_range (sr_file const* f, uint32_t l, uint64_t* first, uint64_t* end) {
+	sr_level const* lv = &f->h->level[l];
+	const uint64_t  n  = __atomic_load_n (&lv->n_written, __ATOMIC_ACQUIRE);
+	/* the oldest record may be rewritten right now */
+	*first = n >= lv->capacity ? n - lv->capacity + 1 : 0;
+	*end   = n;
+}
+
+/* copy record i of level l and convert values to 0..1.
+ * data: [n_max] floats.
+ * returns 0 on success, -1 if the record was (or is being) overwritten.
+ */
+static int sr_read (sr_file const* f, uint32_t l, uint64_t i, sr_record* head, float* data) {
+	sr_level const*  lv = &f->h->level[l];
+	sr_record const* r  = (sr_record const*) &f->map[lv->offset + (i % lv->capacity) * f->h->record_size];
+
+	if (__atomic_load_n (&r->index, __ATOMIC_ACQUIRE) != i) {
+		return -1;
+	}
+	*head = *r;
+	uint32_t n_val = head->n_cols * head->n_traces;
+	if (n_val > f->h->n_max) {
+		n_val = 0;
+	}
+	for (uint32_t k = 0; k < n_val; ++k) {
+		data[k] = r->data[k] / 65535.f;
+	}
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (__atomic_load_n (&r->index, __ATOMIC_RELAXED) != i || n_val == 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* first available record of level l at or after time t [ns],
+ * end if there is none */
+static uint64_t sr_find (sr_file const* f, uint32_t l, int64_t t) {
+	sr_level const* lv = &f->h->level[l];
+	uint64_t lo, hi;
+	sr_range (f, l, &lo, &hi);
+	while (lo < hi) {
+		const uint64_t   i = lo + (hi - lo) / 2;
+		sr_record const* r = (sr_record const*) &f->map[lv->offset + (i % lv->capacity) * f->h->record_size];
+		if (r->time_ns < t) {
+			lo = i + 1;
+		} else {
+			hi = i;
+		}
+	}
+	return lo;
+}
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* lock-free instrumentation: counters and log2 histograms.
+ *
+ * Every counter and histogram has a single writer. Values are 32 bit
+ * and wrap around, readers take snapshots and only use differences
+ * between two snapshots, which can be read from any thread without
+ * locking.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define ST_BUCKETS 16
+
+/* bucket 0: v < 2, bucket b: 2^b <= v < 2^(b+1), last: v >= 2^(ST_BUCKETS-1) */
+typedef struct {
+	volatile uint32_t count[ST_BUCKETS];
+	volatile uint32_t n;
+	volatile uint32_t sum;
+} st_hist;
+
+#if defined __ATOMIC_SEQ_CST
+#define _st_set(P, V) __atomic_store_n (&(P), (V), __ATOMIC_RELAXED)
+#define _st_get(P)    __atomic_load_n (&(P), __ATOMIC_RELAXED)
+#else
+#define _st_set(P, V) (P) = (V)
+#define _st_get(P)    (P)
+#endif
+
+static inline uint64_t st_now (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* writer: increment a counter */
+static inline void st_add (volatile uint32_t* c, uint32_t v) {
+	_st_set (*c, *c + v);
+}
+
+/* writer: add a value to a histogram */
+static inline void st_hist_add (st_hist* h, uint32_t v) {
+	uint32_t b = 0;
+	if (v >= 2) {
+		b = 31 - __builtin_clz (v);
+		if (b >= ST_BUCKETS) {
+			b = ST_BUCKETS - 1;
+		}
+	}
+	_st_set (h->count[b], h->count[b] + 1);
+	_st_set (h->sum, h->sum + v);
+	_st_set (h->n, h->n + 1);
+}
+
+/* reader: copy current values */
+static void st_hist_get (st_hist const* h, st_hist* snapshot) {
+	for (int b = 0; b < ST_BUCKETS; ++b) {
+		snapshot->count[b] = _st_get (h->count[b]);
+	}
+	snapshot->sum = _st_get (h->sum);
+	snapshot->n   = _st_get (h->n);
+}
+
+/* reader: d = a - b, values added between two snapshots */
+static void st_hist_diff (st_hist const* a, st_hist const* b, int32_t* d) {
+	for (int i = 0; i < ST_BUCKETS; ++i) {
+		d[i] = a->count[i] - b->count[i];
+	}
+}
+
+/* reader: mean of the values added between two snapshots */
+static float st_hist_mean (st_hist const* a, st_hist const* b) {
+	const uint32_t n = a->n - b->n;
+	return n > 0 ? (a->sum - b->sum) / (float)n : 0.f;
+}
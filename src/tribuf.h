@@ -0,0 +1,119 @@
+/*
+ *  Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* wait-free single-producer, single-consumer triple buffer.
+ *
+ * The writer fills the back buffer and publishes it by swapping it
+ * with the middle one. The reader swaps the middle buffer with its
+ * front buffer if a new one was published. Neither side ever touches
+ * a buffer owned by the other, and the reader always sees the most
+ * recent complete frame.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#if defined __ATOMIC_SEQ_CST
+
+#define _tb_get(P)     __atomic_load_n (&(P), __ATOMIC_ACQUIRE)
+#define _tb_xchg(P, V) __atomic_exchange_n (&(P), (V), __ATOMIC_ACQ_REL)
+
+#elif defined __GNUC__
+
+#define _tb_get(P)     __sync_add_and_fetch (&(P), 0)
+#define _tb_xchg(P, V) _tb_xchg_sync (&(P), (V))
+
+static inline int _tb_xchg_sync (volatile int* p, int v) {
+	int o;
+	do {
+		o = *p;
+	} while (!__sync_bool_compare_and_swap (p, o, v));
+	return o;
+}
+
+#else
+
+#error triple-buffer requires atomic exchange
+
+#endif
+
+#define TB_FRESH 4
+
+typedef struct {
+	void* buf[3];
+	size_t size;
+	volatile int middle; // index | TB_FRESH
+	int back;  // owned by writer
+	int front; // owned by reader
+} tribuf;
+
+static void tb_free (tribuf* tb) {
+	for (int i = 0; i < 3; ++i) {
+		free (tb->buf[i]);
+	}
+	free (tb);
+}
+
+/* returns NULL if allocation fails */
+static tribuf* tb_alloc (size_t size) {
+	tribuf* tb = (tribuf*) calloc (1, sizeof (tribuf));
+	if (!tb) {
+		return NULL;
+	}
+	tb->size = size;
+	for (int i = 0; i < 3; ++i) {
+		tb->buf[i] = calloc (1, size);
+		if (!tb->buf[i]) {
+			tb_free (tb);
+			return NULL;
+		}
+	}
+	tb->front  = 0;
+	tb->middle = 1;
+	tb->back   = 2;
+	return tb;
+}
+
+/* writer: buffer to fill */
+static void* tb_back (tribuf* tb) {
+	return tb->buf[tb->back];
+}
+
+/* writer: publish back buffer. Returns true if the previously
+ * published buffer was not consumed by the reader.
+ */
+static bool tb_publish (tribuf* tb) {
+	int old = _tb_xchg (tb->middle, tb->back | TB_FRESH);
+	tb->back = old & 3;
+	return (old & TB_FRESH) != 0;
+}
+
+/* reader: returns true if a new buffer became available */
+static bool tb_fetch (tribuf* tb) {
+	if (!(_tb_get (tb->middle) & TB_FRESH)) {
+		return false;
+	}
+	tb->front = _tb_xchg (tb->middle, tb->front) & 3;
+	return true;
+}
+
+/* reader: most recent published buffer */
+static const void* tb_front (tribuf* tb) {
+	return tb->buf[tb->front];
+}
@@ -0,0 +1,613 @@
+/* process-wide analysis thread pool
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* All plugin instances share a bounded pool of worker threads.
+ *
+ * Every instance registers a task. The realtime thread flags the task
+ * as pending (lock-free) and, if the task was not already pending,
+ * posts a semaphore to wake up one worker. Workers pick pending
+ * tasks round-robin. A given task is never executed concurrently by
+ * more than one worker, so the task function sees the same semantics
+ * as a dedicated per-instance thread.
+ *
+ * The pool is created with the first instance and torn down with the
+ * last one (reference counted).
+ *
+ * Worker threads can be configured with the environment variable
+ * X42_MODSPECTRE_WORKER, a comma separated list of key=value pairs:
+ *
+ *   policy=auto|fifo|rr|other|batch|idle
+ *   priority=N   absolute realtime priority, or -N relative to the host
+ *   cpus=LIST    CPU affinity, e.g. "2,3" or "1-3" (Linux only)
+ *   stack=KiB    stack size
+ *   threads=N    number of workers
+ *
+ * The default "auto" policy makes workers follow the host's realtime
+ * thread: if the thread that first submits a task runs with SCHED_FIFO
+ * or SCHED_RR, workers switch to SCHED_FIFO with a priority just below
+ * it (priority=-1). If that fails for lack of permissions, workers keep
+ * running with the default policy.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined __SSE__ || defined __x86_64__
+#include <xmmintrin.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+typedef semaphore_t wp_sem_t;
+#else
+#include <semaphore.h>
+typedef sem_t wp_sem_t;
+#endif
+
+#ifndef WP_MAX_THREADS
+#define WP_MAX_THREADS 16
+#endif
+
+#define WP_PENDING 1
+#define WP_RUNNING 2
+
+#define WP_POLICY_AUTO -1
+
+/* stack size lower bound */
+#define WP_MIN_STACK (256 * 1024)
+
+typedef void (*wp_fn) (void*);
+
+struct WPConfig {
+	int      policy;   // SCHED_*, or WP_POLICY_AUTO
+	int      priority; // absolute, or relative to the host if <= 0
+	size_t   stack;    // bytes, 0: system default
+	uint32_t threads;  // 0: number of CPUs - 1
+#ifdef __linux__
+	cpu_set_t cpus;
+	bool      pin;
+#endif
+};
+
+struct WPTask {
+	wp_fn          fn;
+	void*          arg;
+	volatile int   state;
+	struct WPTask* next;
+};
+
+static struct {
+	pthread_mutex_t lock; // protects task list
+	pthread_cond_t  done; // a task finished running
+	wp_sem_t        wake; // task(s) pending, or shutdown
+	pthread_t       threads[WP_MAX_THREADS];
+	uint32_t        n_threads;
+	uint32_t        refcount;
+	bool            run;
+	struct WPTask*  tasks;
+	struct WPTask*  cursor;
+	struct WPConfig cfg;
+	/* scheduling of the thread that submits tasks */
+	volatile int    host_probed;
+	volatile int    host_policy;
+	volatile int    host_priority;
+	volatile int    sched_gen;
+} wp = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+/* serialize pool creation and tear-down */
+static pthread_mutex_t wp_life_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* *****************************************************************************
+ * semaphore
+ */
+
+#ifdef __APPLE__
+
+static int wp_sem_init (wp_sem_t* s) {
+	return semaphore_create (mach_task_self (), s, SYNC_POLICY_FIFO, 0) == KERN_SUCCESS ? 0 : -1;
+}
+static void wp_sem_destroy (wp_sem_t* s) {
+	semaphore_destroy (mach_task_self (), *s);
+}
+static void wp_sem_post (wp_sem_t* s) {
+	semaphore_signal (*s);
+}
+static void wp_sem_wait (wp_sem_t* s) {
+	semaphore_wait (*s);
+}
+
+#else
+
+static int wp_sem_init (wp_sem_t* s) {
+	return sem_init (s, 0, 0);
+}
+static void wp_sem_destroy (wp_sem_t* s) {
+	sem_destroy (s);
+}
+static void wp_sem_post (wp_sem_t* s) {
+	sem_post (s);
+}
+static void wp_sem_wait (wp_sem_t* s) {
+	while (sem_wait (s) && errno == EINTR) ;
+}
+
+#endif
+
+/* *****************************************************************************
+ * configuration
+ */
+
+#ifdef __linux__
+/* parse "0,2-3" (';' is accepted as separator, too), returns 0 on success */
+static int
+wp_parse_cpus (const char* s, cpu_set_t* set)
+{
+	CPU_ZERO (set);
+	while (*s) {
+		char* end;
+		long  a = strtol (s, &end, 10);
+		long  b = a;
+		if (end == s || a < 0) {
+			return -1;
+		}
+		if (*end == '-') {
+			s = end + 1;
+			b = strtol (s, &end, 10);
+			if (end == s || b < a) {
+				return -1;
+			}
+		}
+		for (long i = a; i <= b && i < CPU_SETSIZE; ++i) {
+			CPU_SET (i, set);
+		}
+		if (*end == ';') {
+			++end;
+		} else if (*end) {
+			return -1;
+		}
+		s = end;
+	}
+	return CPU_COUNT (set) > 0 ? 0 : -1;
+}
+#endif
+
+static int
+wp_parse_policy (const char* s)
+{
+	if (!strcmp (s, "auto")) {
+		return WP_POLICY_AUTO;
+	} else if (!strcmp (s, "fifo")) {
+		return SCHED_FIFO;
+	} else if (!strcmp (s, "rr")) {
+		return SCHED_RR;
+	} else if (!strcmp (s, "other")) {
+		return SCHED_OTHER;
+#ifdef SCHED_BATCH
+	} else if (!strcmp (s, "batch")) {
+		return SCHED_BATCH;
+#endif
+#ifdef SCHED_IDLE
+	} else if (!strcmp (s, "idle")) {
+		return SCHED_IDLE;
+#endif
+	}
+	return -2;
+}
+
+/* read X42_MODSPECTRE_WORKER, unknown or invalid settings are ignored */
+static void
+wp_configure (struct WPConfig* cfg)
+{
+	memset (cfg, 0, sizeof (struct WPConfig));
+	cfg->policy   = WP_POLICY_AUTO;
+	cfg->priority = -1;
+
+	const char* env = getenv ("X42_MODSPECTRE_WORKER");
+	if (!env || strlen (env) > 1023) {
+		return;
+	}
+
+	char  buf[1024];
+	char* save = NULL;
+	strcpy (buf, env);
+
+	for (char* kv = strtok_r (buf, ", ", &save); kv; kv = strtok_r (NULL, ", ", &save)) {
+		char* val = strchr (kv, '=');
+		if (!val) {
+			fprintf (stderr, "modspectre: ignored worker option '%s'\n", kv);
+			continue;
+		}
+		*val++ = '\0';
+		bool ok = true;
+		if (!strcmp (kv, "policy")) {
+			const int p = wp_parse_policy (val);
+			if ((ok = p != -2)) {
+				cfg->policy = p;
+			}
+		} else if (!strcmp (kv, "priority")) {
+			cfg->priority = atoi (val);
+		} else if (!strcmp (kv, "stack")) {
+			const long k = atol (val);
+			if ((ok = k > 0)) {
+				cfg->stack = k * 1024;
+				if (cfg->stack < WP_MIN_STACK) {
+					cfg->stack = WP_MIN_STACK;
+				}
+			}
+		} else if (!strcmp (kv, "threads")) {
+			const int n = atoi (val);
+			if ((ok = n > 0)) {
+				cfg->threads = n > WP_MAX_THREADS ? WP_MAX_THREADS : n;
+			}
+#ifdef __linux__
+		} else if (!strcmp (kv, "cpus")) {
+			ok = cfg->pin = 0 == wp_parse_cpus (val, &cfg->cpus);
+#endif
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			fprintf (stderr, "modspectre: ignored worker option '%s=%s'\n", kv, val);
+		}
+	}
+}
+
+/* *****************************************************************************
+ * worker thread setup
+ */
+
+/* flush denormals to zero, decaying bins must not cause CPU spikes.
+ * Returns the previous state for wp_fp_restore() */
+static uint64_t
+wp_denormals (void)
+{
+#if defined __SSE2__ || defined __x86_64__
+	const uint32_t csr = _mm_getcsr ();
+	_mm_setcsr (csr | 0x8040); // FTZ | DAZ
+	return csr;
+#elif defined __SSE__
+	const uint32_t csr = _mm_getcsr ();
+	_mm_setcsr (csr | 0x8000); // FTZ, DAZ needs SSE2
+	return csr;
+#elif defined __aarch64__
+	uint64_t fpcr;
+	__asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+	__asm__ volatile("msr fpcr, %0" ::"r"(fpcr | (1 << 24)));
+	return fpcr;
+#elif defined __arm__ && defined __ARM_FP
+	uint32_t fpscr;
+	__asm__ volatile("vmrs %0, fpscr" : "=r"(fpscr));
+	__asm__ volatile("vmsr fpscr, %0" ::"r"(fpscr | (1 << 24)));
+	return fpscr;
+#else
+	return 0;
+#endif
+}
+
+/* used when analyzing in a thread that is owned by the host */
+static void
+wp_fp_restore (uint64_t state)
+{
+#if defined __SSE__ || defined __x86_64__
+	_mm_setcsr ((uint32_t)state);
+#elif defined __aarch64__
+	__asm__ volatile("msr fpcr, %0" ::"r"(state));
+#elif defined __arm__ && defined __ARM_FP
+	__asm__ volatile("vmsr fpscr, %0" ::"r"((uint32_t)state));
+#endif
+}
+
+/* true if the worker priority depends on the host's thread */
+static inline bool
+wp_follows_host (void)
+{
+	switch (wp.cfg.policy) {
+		case WP_POLICY_AUTO:
+			return true;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			return wp.cfg.priority <= 0;
+		default:
+			return false;
+	}
+}
+
+/* realtime safe, called with every submit: remember the scheduling
+ * of the first thread that submits a task, workers follow it. */
+static inline void
+wp_probe_host (void)
+{
+	if (wp.host_probed || !wp_follows_host ()) {
+		return;
+	}
+	int                policy;
+	struct sched_param sp;
+	wp.host_probed = 1;
+	if (pthread_getschedparam (pthread_self (), &policy, &sp)) {
+		return;
+	}
+	wp.host_policy   = policy;
+	wp.host_priority = sp.sched_priority;
+	__sync_fetch_and_add (&wp.sched_gen, 1);
+}
+
+/* apply scheduling settings to the calling worker thread */
+static void
+wp_set_sched (void)
+{
+	const bool host_rt  = wp.host_policy == SCHED_FIFO || wp.host_policy == SCHED_RR;
+	int        policy   = wp.cfg.policy;
+	int        priority = wp.cfg.priority;
+
+	if (policy == WP_POLICY_AUTO) {
+		if (!host_rt) {
+			return;
+		}
+		policy = SCHED_FIFO;
+	}
+
+	if (policy == SCHED_FIFO || policy == SCHED_RR) {
+		if (priority <= 0) {
+			if (!host_rt) {
+				return; // wait until the host priority is known
+			}
+			priority += wp.host_priority;
+		}
+		const int p_min = sched_get_priority_min (policy);
+		const int p_max = sched_get_priority_max (policy);
+		if (priority < p_min) {
+			priority = p_min;
+		}
+		if (priority > p_max) {
+			priority = p_max;
+		}
+	} else {
+		priority = 0;
+	}
+
+	struct sched_param sp;
+	memset (&sp, 0, sizeof (struct sched_param));
+	sp.sched_priority = priority;
+	const int rv      = pthread_setschedparam (pthread_self (), policy, &sp);
+
+	static volatile int reported = 0;
+	if (rv && __sync_bool_compare_and_swap (&reported, 0, 1)) {
+		fprintf (stderr, "modspectre: cannot set worker scheduling (policy %d, priority %d): %s\n",
+		         policy, priority, strerror (rv));
+	}
+}
+
+/* *****************************************************************************
+ * pool
+ */
+
+/* find and claim a pending task, round-robin. wp.lock must be held */
+static struct WPTask*
+wp_claim (void)
+{
+	if (!wp.tasks) {
+		return NULL;
+	}
+	struct WPTask* t = wp.cursor ? wp.cursor : wp.tasks;
+	struct WPTask* s = t;
+	do {
+		if (__sync_bool_compare_and_swap (&t->state, WP_PENDING, WP_RUNNING)) {
+			wp.cursor = t->next;
+			return t;
+		}
+		t = t->next ? t->next : wp.tasks;
+	} while (t != s);
+	return NULL;
+}
+
+static void*
+wp_worker (void* arg)
+{
+	int sched_gen = -1;
+
+	wp_denormals ();
+
+#ifdef __linux__
+	if (wp.cfg.pin) {
+		pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &wp.cfg.cpus);
+	}
+#endif
+
+	while (true) {
+		/* the host thread may only become known later, or change */
+		if (sched_gen != wp.sched_gen) {
+			sched_gen = wp.sched_gen;
+			wp_set_sched ();
+		}
+		wp_sem_wait (&wp.wake);
+		if (!wp.run) {
+			break;
+		}
+		if (sched_gen != wp.sched_gen) {
+			sched_gen = wp.sched_gen;
+			wp_set_sched ();
+		}
+		/* a task that became pending again while it was running does
+		 * not re-post the semaphore, so keep going until none is left.
+		 */
+		pthread_mutex_lock (&wp.lock);
+		struct WPTask* t;
+		while ((t = wp_claim ())) {
+			pthread_mutex_unlock (&wp.lock);
+
+			t->fn (t->arg);
+
+			pthread_mutex_lock (&wp.lock);
+			__sync_fetch_and_and (&t->state, ~WP_RUNNING);
+			pthread_cond_broadcast (&wp.done);
+		}
+		pthread_mutex_unlock (&wp.lock);
+	}
+	return NULL;
+}
+
+static uint32_t
+wp_thread_count (void)
+{
+	if (wp.cfg.threads > 0) {
+		return wp.cfg.threads;
+	}
+	long n_cpu = 2;
+#ifdef __linux__
+	if (wp.cfg.pin) {
+		n_cpu = CPU_COUNT (&wp.cfg.cpus) + 1;
+	} else
+#endif
+#ifdef _SC_NPROCESSORS_ONLN
+	n_cpu = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	/* leave one core for the audio thread */
+	if (n_cpu > 1) {
+		--n_cpu;
+	}
+	if (n_cpu < 1) {
+		n_cpu = 1;
+	}
+	return n_cpu > WP_MAX_THREADS ? WP_MAX_THREADS : n_cpu;
+}
+
+/* add a reference to the pool, start workers if needed */
+static int
+wp_init (void)
+{
+	int rv = 0;
+	pthread_mutex_lock (&wp_life_lock);
+	pthread_mutex_lock (&wp.lock);
+	if (wp.refcount == 0) {
+		wp_configure (&wp.cfg);
+		const uint32_t n = wp_thread_count ();
+		wp.run           = true;
+		wp.n_threads     = 0;
+		wp.host_probed   = 0;
+		wp.host_policy   = SCHED_OTHER;
+		wp.host_priority = 0;
+		if (wp_sem_init (&wp.wake)) {
+			pthread_mutex_unlock (&wp.lock);
+			pthread_mutex_unlock (&wp_life_lock);
+			return -1;
+		}
+		pthread_attr_t attr;
+		pthread_attr_t* a = NULL;
+		if (wp.cfg.stack > 0 && 0 == pthread_attr_init (&attr)) {
+			a = &attr;
+			if (pthread_attr_setstacksize (a, wp.cfg.stack)) {
+				fprintf (stderr, "modspectre: invalid worker stack size\n");
+			}
+		}
+		for (uint32_t i = 0; i < n; ++i) {
+			if (pthread_create (&wp.threads[i], a, wp_worker, NULL)) {
+				break;
+			}
+			++wp.n_threads;
+		}
+		if (a) {
+			pthread_attr_destroy (a);
+		}
+		if (wp.n_threads == 0) {
+			wp.run = false;
+			wp_sem_destroy (&wp.wake);
+			rv = -1;
+		}
+	}
+	if (rv == 0) {
+		++wp.refcount;
+	}
+	pthread_mutex_unlock (&wp.lock);
+	pthread_mutex_unlock (&wp_life_lock);
+	return rv;
+}
+
+/* drop a reference, the last one terminates all workers */
+static void
+wp_fini (void)
+{
+	pthread_mutex_lock (&wp_life_lock);
+	pthread_mutex_lock (&wp.lock);
+	if (wp.refcount == 0 || --wp.refcount > 0) {
+		pthread_mutex_unlock (&wp.lock);
+		pthread_mutex_unlock (&wp_life_lock);
+		return;
+	}
+	wp.run = false;
+	pthread_mutex_unlock (&wp.lock);
+
+	for (uint32_t i = 0; i < wp.n_threads; ++i) {
+		wp_sem_post (&wp.wake);
+	}
+	for (uint32_t i = 0; i < wp.n_threads; ++i) {
+		pthread_join (wp.threads[i], NULL);
+	}
+	wp_sem_destroy (&wp.wake);
+	wp.n_threads = 0;
+	pthread_mutex_unlock (&wp_life_lock);
+}
+
+static void
+wp_add (struct WPTask* t, wp_fn fn, void* arg)
+{
+	t->fn    = fn;
+	t->arg   = arg;
+	t->state = 0;
+	pthread_mutex_lock (&wp.lock);
+	t->next  = wp.tasks;
+	wp.tasks = t;
+	pthread_mutex_unlock (&wp.lock);
+}
+
+/* unregister task, wait until it is no longer running */
+static void
+wp_remove (struct WPTask* t)
+{
+	pthread_mutex_lock (&wp.lock);
+	for (struct WPTask** p = &wp.tasks; *p; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+	if (wp.cursor == t) {
+		wp.cursor = t->next;
+	}
+	while (t->state & WP_RUNNING) {
+		pthread_cond_wait (&wp.done, &wp.lock);
+	}
+	pthread_mutex_unlock (&wp.lock);
+}
+
+/* realtime safe, flag task as pending and wake up a worker */
+static void
+wp_submit (struct WPTask* t)
+{
+	wp_probe_host ();
+	if (!(__sync_fetch_and_or (&t->state, WP_PENDING) & WP_PENDING)) {
+		wp_sem_post (&wp.wake);
+	}
+}
@@ -0,0 +1,716 @@
+/* modspectre.lv2 - offline batch analysis
+ *
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Analyze audio files faster than realtime, with the plugin's own
+ * analysis code. The plugin is compiled in and driven the same way
+ * a freewheeling host does: audio is passed to feed_fft() in large
+ * blocks, the analysis runs synchronously as LV2 worker job, and every
+ * frame is written to a CSV or binary file per input.
+ *
+ * Files (or channels, -s) are analyzed in parallel on the thread-pool,
+ * see src/workpool.c.
+ */
+
+#define BATCH_ANALYSIS
+#include "modspectre.c"
+
+#include <getopt.h>
+#include <inttypes.h>
+
+#define DEFAULT_BLOCK 32768
+#define MAX_BLOCK     (FFT_MAX * 2) // less than to_fft capacity
+
+/* *****************************************************************************
+ * URID map
+ */
+
+static pthread_mutex_t urid_lock = PTHREAD_MUTEX_INITIALIZER;
+static char**          urid_uris = NULL;
+static uint32_t        urid_n    = 0;
+
+static LV2_URID
+urid_map (LV2_URID_Map_Handle handle, const char* uri)
+{
+	pthread_mutex_lock (&urid_lock);
+	for (uint32_t i = 0; i < urid_n; ++i) {
+		if (!strcmp (urid_uris[i], uri)) {
+			pthread_mutex_unlock (&urid_lock);
+			return i + 1;
+		}
+	}
+	/* 0: no URID, if allocation fails */
+	LV2_URID id  = 0;
+	char**   tmp = (char**)realloc (urid_uris, (urid_n + 1) * sizeof (char*));
+	if (tmp) {
+		urid_uris = tmp;
+		urid_uris[urid_n] = strdup (uri);
+		if (urid_uris[urid_n]) {
+			id = ++urid_n;
+		}
+	}
+	pthread_mutex_unlock (&urid_lock);
+	return id;
+}
+
+static void
+urid_free (void)
+{
+	for (uint32_t i = 0; i < urid_n; ++i) {
+		free (urid_uris[i]);
+	}
+	free (urid_uris);
+}
+
+/* *****************************************************************************
+ * WAV reader, PCM 16, 24, 32 bit and float 32, 64 bit
+ */
+
+typedef struct {
+	FILE*    f;
+	uint32_t n_channels;
+	double   rate;
+	uint32_t format; // 1: PCM, 3: IEEE float
+	uint32_t bytes;  // per sample
+	uint64_t n_frames;
+	uint64_t pos;
+	uint8_t* raw;    // [MAX_BLOCK * n_channels * bytes]
+} WavFile;
+
+static uint32_t
+le16 (uint8_t const* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+le32 (uint8_t const* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+wav_close (WavFile* w)
+{
+	if (!w) {
+		return;
+	}
+	if (w->f) {
+		fclose (w->f);
+	}
+	free (w->raw);
+	free (w);
+}
+
+static WavFile*
+wav_open (const char* path)
+{
+	WavFile* w = (WavFile*)calloc (1, sizeof (WavFile));
+	uint8_t  hdr[40];
+	bool     have_fmt = false;
+
+	if (!w || !(w->f = fopen (path, "rb"))) {
+		free (w);
+		return NULL;
+	}
+	if (fread (hdr, 1, 12, w->f) != 12 || memcmp (hdr, "RIFF", 4) || memcmp (hdr + 8, "WAVE", 4)) {
+		wav_close (w);
+		return NULL;
+	}
+
+	while (true) {
+		if (fread (hdr, 1, 8, w->f) != 8) {
+			wav_close (w);
+			return NULL;
+		}
+		const uint32_t size = le32 (hdr + 4);
+		if (!memcmp (hdr, "data", 4)) {
+			break;
+		}
+		if (!memcmp (hdr, "fmt ", 4) && size >= 16 && size <= sizeof (hdr)) {
+			if (fread (hdr, 1, size, w->f) != size) {
+				wav_close (w);
+				return NULL;
+			}
+			w->format     = le16 (hdr);
+			w->n_channels = le16 (hdr + 2);
+			w->rate       = le32 (hdr + 4);
+			w->bytes      = le16 (hdr + 14) / 8;
+			if (w->format == 0xfffe && size >= 26) {
+				w->format = le16 (hdr + 24); // WAVE_FORMAT_EXTENSIBLE sub-format
+			}
+			have_fmt = true;
+			if (size & 1) {
+				fseek (w->f, 1, SEEK_CUR);
+			}
+			continue;
+		}
+		if (fseek (w->f, size + (size & 1), SEEK_CUR)) {
+			wav_close (w);
+			return NULL;
+		}
+	}
+
+	const bool pcm = w->format == 1 && (w->bytes == 2 || w->bytes == 3 || w->bytes == 4);
+	const bool flt = w->format == 3 && (w->bytes == 4 || w->bytes == 8);
+	if (!have_fmt || !(pcm || flt) || w->n_channels < 1 || w->rate < 8000) {
+		wav_close (w);
+		return NULL;
+	}
+
+	/* the data size may be unset when recording was interrupted, read until EOF */
+	const uint32_t size = le32 (hdr + 4);
+	w->n_frames = size > 0 && size != 0xffffffff ? size / (w->n_channels * w->bytes) : UINT64_MAX;
+	w->raw      = (uint8_t*)malloc ((size_t)MAX_BLOCK * w->n_channels * w->bytes);
+	if (!w->raw) {
+		wav_close (w);
+		return NULL;
+	}
+	return w;
+}
+
+static float
+wav_sample (WavFile const* w, uint8_t const* p)
+{
+	if (w->format == 3) {
+		if (w->bytes == 8) {
+			double d;
+			memcpy (&d, p, 8);
+			return d;
+		}
+		float f;
+		memcpy (&f, p, 4);
+		return f;
+	}
+	switch (w->bytes) {
+		case 2:
+			return (int16_t)le16 (p) / 32768.f;
+		case 3:
+			return (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.f;
+		default:
+			return (int32_t)le32 (p) / 2147483648.f;
+	}
+}
+
+/* read up to n frames, deinterleave channel c, or all channels if c < 0.
+ * returns the number of frames read */
+static uint32_t
+wav_read (WavFile* w, float* const* buf, int c, uint32_t n)
+{
+	if (n > w->n_frames - w->pos) {
+		n = w->n_frames - w->pos;
+	}
+	const size_t fs = w->n_channels * w->bytes;
+	n = fread (w->raw, fs, n, w->f);
+
+	const uint32_t c0 = c < 0 ? 0 : c;
+	const uint32_t c1 = c < 0 ? w->n_channels : c + 1;
+	for (uint32_t i = 0; i < n; ++i) {
+		uint8_t const* p = &w->raw[i * fs];
+		for (uint32_t ch = c0; ch < c1; ++ch) {
+			buf[ch - c0][i] = wav_sample (w, &p[ch * w->bytes]);
+		}
+	}
+	w->pos += n;
+	return n;
+}
+
+/* *****************************************************************************
+ * analysis jobs
+ */
+
+typedef struct {
+	float       ports[P_LAST]; // control port values
+	float       midside;
+	float       corr;
+	uint32_t    block;
+	bool        binary;
+	bool        split;
+	const char* outdir;
+} Settings;
+
+typedef struct {
+	struct WPTask   task;
+	Settings const* cfg;
+	const char*     path;
+	int             channel; // -1: all channels of the file
+	char            out[1024];
+
+	/* state, owned by the job */
+	ModSpectre*         self;
+	LV2_Worker_Schedule sched;
+	FILE*               fout;
+	double              rate_in;
+	uint64_t            pos;  // input samples analyzed
+	uint32_t            rp;   // last to_fft read position
+	uint32_t            n_cols;
+	uint32_t            n_traces;
+
+	/* result */
+	int      rv;
+	uint64_t n_frames;
+	double   duration; // audio [sec]
+	double   wall;     // [sec]
+	double   cpu;      // [sec]
+} Job;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  done_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t        n_done    = 0;
+
+static LV2_URID_Map urid = { NULL, urid_map };
+
+static double
+clock_sec (clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime (id, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* synchronous LV2 worker, like a host in freewheel mode */
+static LV2_Worker_Status
+sync_respond (LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+	return work_response ((LV2_Handle)handle, size, data);
+}
+
+static LV2_Worker_Status
+sync_schedule (LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+	Job* job = (Job*)handle;
+	return work ((LV2_Handle)job->self, sync_respond, job->self, size, data);
+}
+
+static double
+freq_at_col (uint32_t n_cols, uint32_t c)
+{
+	return 20.0 * pow (1000.0, (c + .5) / n_cols);
+}
+
+/* called from publish() for every frame */
+static void
+batch_frame (ModSpectre* self)
+{
+	Job* job = (Job*)self->schedule->handle;
+	if (!job->fout) {
+		return;
+	}
+	const uint32_t n_cols   = self->n_cols;
+	const uint32_t n_traces = self->n_traces;
+
+	job->pos += (uint32_t)(self->rp - job->rp);
+	job->rp = self->rp;
+	++job->n_frames;
+
+	if (job->cfg->binary) {
+		sr_record head;
+		memset (&head, 0, sizeof (head));
+		head.index    = job->n_frames - 1;
+		head.time_ns  = job->pos * 1e9 / job->rate_in;
+		head.rate     = self->rate;
+		head.frame    = self->seq;
+		head.n_frames = 1;
+		head.fft_size = self->cqx ? 0 : self->fftx->window_size;
+		head.n_cols   = n_cols;
+		head.n_traces = n_traces;
+		head.flags    = (self->midside ? SR_MIDSIDE : 0) | (self->corr ? SR_CORRELATION : 0);
+		fwrite (&head, sizeof (sr_record), 1, job->fout);
+		fwrite (self->bins, sizeof (float), n_cols * n_traces, job->fout);
+		return;
+	}
+
+	if (n_cols != job->n_cols || n_traces != job->n_traces) {
+		job->n_cols   = n_cols;
+		job->n_traces = n_traces;
+		fprintf (job->fout, "time,frame");
+		for (uint32_t t = 0; t < n_traces; ++t) {
+			for (uint32_t k = 0; k < n_cols; ++k) {
+				fprintf (job->fout, ",%.1f", freq_at_col (n_cols, k));
+			}
+		}
+		fprintf (job->fout, "\n");
+	}
+	/* %.9g round-trips float values exactly */
+	fprintf (job->fout, "%.6f,%u", job->pos / job->rate_in, self->seq);
+	for (uint32_t k = 0; k < n_cols * n_traces; ++k) {
+		fprintf (job->fout, ",%.9g", self->bins[k]);
+	}
+	fprintf (job->fout, "\n");
+}
+
+static int
+descriptor_index (uint32_t n_ch)
+{
+	switch (n_ch) {
+		case 1:
+			return 0;
+		case 2:
+			return 1;
+		case 4:
+			return 2;
+		case 8:
+			return 3;
+		default:
+			return -1;
+	}
+}
+
+static int
+run_job (Job* job)
+{
+	Settings const* cfg = job->cfg;
+
+	WavFile* w = wav_open (job->path);
+	if (!w) {
+		fprintf (stderr, "Cannot read '%s'\n", job->path);
+		return -1;
+	}
+	const uint32_t        n_ch = job->channel < 0 ? w->n_channels : 1;
+	const LV2_Descriptor* d    = lv2_descriptor (descriptor_index (n_ch));
+	if (!d) {
+		wav_close (w);
+		return -1;
+	}
+
+	job->sched.handle        = job;
+	job->sched.schedule_work = sync_schedule;
+	const LV2_Feature  map_feat   = { LV2_URID__map, &urid };
+	const LV2_Feature  sched_feat = { LV2_WORKER__schedule, &job->sched };
+	const LV2_Feature* features[] = { &map_feat, &sched_feat, NULL };
+
+	ModSpectre* self = job->self = (ModSpectre*)d->instantiate (d, w->rate, ".", features);
+	if (!self) {
+		wav_close (w);
+		return -1;
+	}
+
+	float* buf[MAX_CHANNELS];
+	float  ports[P_LAST + PM_LAST];
+	memcpy (ports, cfg->ports, sizeof (cfg->ports));
+	ports[P_LAST + PM_MIDSIDE]     = cfg->midside;
+	ports[P_LAST + PM_CORRELATION] = cfg->corr;
+
+	for (uint32_t p = 0; p < P_LAST; ++p) {
+		if (p != P_AIN && p != P_NOTIFY) {
+			d->connect_port (self, p, &ports[p]);
+		}
+	}
+	for (uint32_t p = 0; p < PM_LAST && n_ch > 1; ++p) {
+		d->connect_port (self, P_LAST + n_ch - 1 + p, &ports[P_LAST + p]);
+	}
+	bool have_buf = true;
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		buf[c] = (float*)malloc (cfg->block * sizeof (float));
+		if (!buf[c]) {
+			have_buf = false;
+		}
+		d->connect_port (self, c == 0 ? P_AIN : P_LAST + c - 1, buf[c]);
+	}
+
+	int rv       = -1;
+	job->fout    = have_buf ? fopen (job->out, cfg->binary ? "wb" : "w") : NULL;
+	job->rate_in = w->rate;
+	job->rp      = self->rp;
+	if (!have_buf) {
+		fprintf (stderr, "Out of memory, '%s' skipped\n", job->path);
+	} else if (!job->fout) {
+		fprintf (stderr, "Cannot write '%s'\n", job->out);
+	} else {
+		/* apply the settings before any audio is passed, the
+		 * analysis starts with the first sample */
+		read_ports (self);
+		worker (self);
+
+		uint32_t n;
+		while ((n = wav_read (w, buf, job->channel, cfg->block)) > 0) {
+			feed_fft (self, n);
+		}
+		job->duration = w->pos / w->rate;
+		fclose (job->fout);
+		job->fout = NULL;
+		rv        = 0;
+	}
+
+	d->cleanup (self);
+	for (uint32_t c = 0; c < n_ch; ++c) {
+		free (buf[c]);
+	}
+	wav_close (w);
+	return rv;
+}
+
+/* called from the thread-pool */
+static void
+process (void* arg)
+{
+	Job*         job = (Job*)arg;
+	const double t0  = clock_sec (CLOCK_MONOTONIC);
+	const double c0  = clock_sec (CLOCK_THREAD_CPUTIME_ID);
+
+	job->rv   = run_job (job);
+	job->wall = clock_sec (CLOCK_MONOTONIC) - t0;
+	job->cpu  = clock_sec (CLOCK_THREAD_CPUTIME_ID) - c0;
+
+	pthread_mutex_lock (&done_lock);
+	++n_done;
+	pthread_cond_signal (&done_cond);
+	pthread_mutex_unlock (&done_lock);
+}
+
+/* <outdir>/<basename>[.<channel>].csv */
+static void
+output_path (Job* job, bool multichannel)
+{
+	const char* base = strrchr (job->path, '/');
+	base             = base ? base + 1 : job->path;
+	const char* ext  = strrchr (base, '.');
+	const int   len  = ext && ext != base ? ext - base : (int)strlen (base);
+	char        chn[16] = "";
+	if (job->channel >= 0 && multichannel) {
+		snprintf (chn, sizeof (chn), ".%d", job->channel + 1);
+	}
+	snprintf (job->out, sizeof (job->out), "%s/%.*s%s.%s",
+	          job->cfg->outdir, len, base, chn, job->cfg->binary ? "bin" : "csv");
+}
+
+static void
+usage (void)
+{
+	printf ("modspectre-batch - offline spectrum analysis\n\n"
+	        "Usage: modspectre-batch [ OPTIONS ] <file.wav> [ file.wav ... ]\n\n"
+	        "Options:\n"
+	        "  -b <frames>  samples per block (default %d, max %d)\n"
+	        "  -B           binary output, see below\n"
+	        "  -c <cols>    display columns, %d..%d (default 256)\n"
+	        "  -e <engine>  fft or cqt (constant-Q, mono only) (default fft)\n"
+	        "  -f <size>    FFT size, 1024..32768 (default 4096)\n"
+	        "  -h           print this message\n"
+	        "  -j <n>       number of parallel jobs (default: number of CPUs)\n"
+	        "  -m <mode>    0: phase corrected, 1: peak, 2: power sum,\n"
+	        "               3: 1/6 octave, 4: 1/3 octave (default 1)\n"
+	        "  -M           add mid/side traces (multichannel)\n"
+	        "  -o <dir>     output directory (default .)\n"
+	        "  -p <fps>     analysis frames per second, 1..60 (default 30)\n"
+	        "  -q           quiet, only print the summary\n"
+	        "  -r <resp>    response time, 0.01..10 (default 1)\n"
+	        "  -s           analyze every channel separately (mono)\n"
+	        "  -v <ovl>     min. window overlap, 0..0.875 (default 0)\n"
+	        "  -X           add correlation traces (multichannel)\n"
+	        "\n"
+	        "Files with 1, 2, 4 or 8 channels are analyzed with the\n"
+	        "corresponding plugin variant, other files per channel.\n"
+	        "Files and channels are processed in parallel.\n"
+	        "\n"
+	        "The analysis is identical to the plugin's with the same settings,\n"
+	        "applied before the first sample. Every frame is written to\n"
+	        "<dir>/<name>[.<channel>].csv: time [sec] of the last analyzed\n"
+	        "sample, frame number and values 0..1 (-96..0dB, correlation -1..+1)\n"
+	        "of every column of every trace. The first line lists column\n"
+	        "frequencies. Binary output (.bin) has a sr_record head per frame\n"
+	        "(see src/specrec.h, time_ns is relative to the start of the file),\n"
+	        "followed by n_traces * n_cols float values.\n"
+	        "Like the plugin, no frames are written for silence (below -120dBFS)\n"
+	        "once all values decayed to zero.\n",
+	        DEFAULT_BLOCK, MAX_BLOCK, MIN_COLS, N_BINS);
+}
+
+int
+main (int argc, char** argv)
+{
+	Settings cfg;
+	memset (&cfg, 0, sizeof (cfg));
+	cfg.ports[P_RESPONSE] = 1.0;
+	cfg.ports[P_MODE]     = 1;
+	cfg.ports[P_FFTSIZE]  = 4096;
+	cfg.ports[P_COLUMNS]  = 256;
+	cfg.ports[P_ENCODING] = BC_FLOAT;
+	cfg.ports[P_FPS]      = 30;
+	cfg.ports[P_OVERLAP]  = 0;
+	cfg.ports[P_ENGINE]   = E_FFT;
+	cfg.block             = DEFAULT_BLOCK;
+	cfg.outdir            = ".";
+
+	int  n_jobs = 0;
+	bool quiet  = false;
+
+	int c;
+	while ((c = getopt (argc, argv, "b:Bc:e:f:hj:m:Mo:p:qr:sv:X")) != -1) {
+		switch (c) {
+			case 'b':
+				cfg.block = atoi (optarg);
+				if (cfg.block < 1 || cfg.block > MAX_BLOCK) {
+					fprintf (stderr, "Invalid block size\n");
+					return 1;
+				}
+				break;
+			case 'B':
+				cfg.binary = true;
+				break;
+			case 'c':
+				cfg.ports[P_COLUMNS] = atoi (optarg);
+				break;
+			case 'e':
+				cfg.ports[P_ENGINE] = !strcmp (optarg, "cqt") ? E_CQT : E_FFT;
+				break;
+			case 'f':
+				cfg.ports[P_FFTSIZE] = atoi (optarg);
+				break;
+			case 'h':
+				usage ();
+				return 0;
+			case 'j':
+				n_jobs = atoi (optarg);
+				if (n_jobs < 1) {
+					fprintf (stderr, "Invalid number of jobs\n");
+					return 1;
+				}
+				break;
+			case 'm':
+				cfg.ports[P_MODE] = atoi (optarg);
+				break;
+			case 'M':
+				cfg.midside = 1;
+				break;
+			case 'o':
+				cfg.outdir = optarg;
+				break;
+			case 'p':
+				cfg.ports[P_FPS] = atof (optarg);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'r':
+				cfg.ports[P_RESPONSE] = atof (optarg);
+				break;
+			case 's':
+				cfg.split = true;
+				break;
+			case 'v':
+				cfg.ports[P_OVERLAP] = atof (optarg);
+				break;
+			case 'X':
+				cfg.corr = 1;
+				break;
+			default:
+				usage ();
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage ();
+		return 1;
+	}
+
+	/* one job per file, or per channel */
+	Job*     jobs   = NULL;
+	uint32_t n_todo = 0;
+	for (int i = optind; i < argc; ++i) {
+		WavFile* w = wav_open (argv[i]);
+		if (!w) {
+			fprintf (stderr, "Cannot read '%s', skipped\n", argv[i]);
+			continue;
+		}
+		const uint32_t n_ch  = w->n_channels;
+		const bool     split = cfg.split || descriptor_index (n_ch) < 0;
+		wav_close (w);
+
+		for (uint32_t ch = 0; ch < (split ? n_ch : 1); ++ch) {
+			Job* tmp = (Job*)realloc (jobs, (n_todo + 1) * sizeof (Job));
+			if (!tmp) {
+				fprintf (stderr, "Out of memory\n");
+				free (jobs);
+				return 1;
+			}
+			jobs     = tmp;
+			Job* job = &jobs[n_todo++];
+			memset (job, 0, sizeof (Job));
+			job->cfg     = &cfg;
+			job->path    = argv[i];
+			job->channel = split ? (int)ch : -1;
+			output_path (job, n_ch > 1);
+		}
+	}
+
+	if (n_todo == 0) {
+		return 1;
+	}
+
+	/* default: one worker thread per CPU */
+	if (n_jobs == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		n_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if (n_jobs > 0 && !getenv ("X42_MODSPECTRE_WORKER")) {
+		char tmp[32];
+		snprintf (tmp, sizeof (tmp), "threads=%d", n_jobs);
+		setenv ("X42_MODSPECTRE_WORKER", tmp, 1);
+	}
+
+	if (wp_init ()) {
+		fprintf (stderr, "Cannot start worker threads\n");
+		free (jobs);
+		return 1;
+	}
+
+	const double t0 = clock_sec (CLOCK_MONOTONIC);
+	for (uint32_t i = 0; i < n_todo; ++i) {
+		wp_add (&jobs[i].task, process, &jobs[i]);
+		wp_submit (&jobs[i].task);
+	}
+
+	pthread_mutex_lock (&done_lock);
+	while (n_done < n_todo) {
+		pthread_cond_wait (&done_cond, &done_lock);
+	}
+	pthread_mutex_unlock (&done_lock);
+	const double wall = clock_sec (CLOCK_MONOTONIC) - t0;
+
+	double   duration = 0;
+	double   cpu      = 0;
+	uint64_t n_frames = 0;
+	int      rv       = 0;
+	for (uint32_t i = 0; i < n_todo; ++i) {
+		Job* job = &jobs[i];
+		wp_remove (&job->task);
+		if (job->rv) {
+			rv = 1;
+			continue;
+		}
+		duration += job->duration;
+		cpu += job->cpu;
+		n_frames += job->n_frames;
+		if (!quiet) {
+			printf ("%s -> %s: %" PRIu64 " frames, %.1fs audio, %.1fx realtime\n",
+			        job->path, job->out, job->n_frames, job->duration,
+			        job->wall > 0 ? job->duration / job->wall : 0);
+		}
+	}
+	wp_fini ();
+
+	printf ("%u job(s), %" PRIu64 " frames, %.1fs audio in %.2fs: %.1fx realtime (%.1fx per CPU second)\n",
+	        n_todo, n_frames, duration, wall,
+	        wall > 0 ? duration / wall : 0,
+	        cpu > 0 ? duration / cpu : 0);
+
+	free (jobs);
+	urid_free ();
+	return rv;
+}
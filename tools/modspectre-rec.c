@@ -0,0 +1,286 @@
+/* modspectre.lv2 - spectrogram recording reader
+ *
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Show or dump a time-range of a recording made with
+ * X42_MODSPECTRE_REC=<dir>, see src/specrec.h. The file may be read
+ * while the plugin is still recording.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "specrec.h"
+
+static double
+freq_at_col (uint32_t n_cols, uint32_t c)
+{
+	return 20.0 * pow (1000.0, (c + .5) / n_cols);
+}
+
+static void
+print_time (int64_t t_ns)
+{
+	const time_t t = t_ns / 1000000000LL;
+	struct tm    tm;
+	char         buf[32];
+	localtime_r (&t, &tm);
+	strftime (buf, sizeof (buf), "%Y-%m-%d %H:%M:%S", &tm);
+	printf ("%s.%03d", buf, (int)((t_ns / 1000000) % 1000));
+}
+
+/* time of the oldest and newest available record of a level,
+ * returns false if the level is empty */
+static bool
+level_span (sr_file const* f, uint32_t l, int64_t* t0, int64_t* t1, float* data)
+{
+	uint64_t  first, end;
+	sr_record r;
+	sr_range (f, l, &first, &end);
+	*t0 = *t1 = 0;
+	while (first < end && sr_read (f, l, first, &r, data)) {
+		++first; // overwritten meanwhile
+	}
+	if (first >= end) {
+		return false;
+	}
+	*t0 = r.time_ns;
+	if (sr_read (f, l, end - 1, &r, data)) {
+		return false;
+	}
+	*t1 = r.time_ns;
+	return true;
+}
+
+static void
+info (sr_file const* f, float* data)
+{
+	sr_header const* h = f->h;
+	printf ("channels: %u\n", h->n_channels);
+	printf ("record:   %u bytes, %u values\n", h->record_size, h->n_max);
+	for (uint32_t l = 0; l < SR_LEVELS; ++l) {
+		uint64_t first, end;
+		int64_t  t0, t1;
+		sr_range (f, l, &first, &end);
+		printf ("level %u:  %2ux, %" PRIu64 " / %" PRIu64 " records",
+		        l, h->level[l].factor, end - first, h->level[l].capacity);
+		if (level_span (f, l, &t0, &t1, data)) {
+			printf (", ");
+			print_time (t0);
+			printf (" .. ");
+			print_time (t1);
+			printf (" (%.1fs)", (t1 - t0) * 1e-9);
+		}
+		printf ("\n");
+	}
+}
+
+/* relative times are seconds before the most recent record */
+static int64_t
+parse_time (const char* s, int64_t now)
+{
+	const double t = atof (s);
+	if (t <= 0) {
+		return now + t * 1e9;
+	}
+	return t * 1e9;
+}
+
+static void
+usage (void)
+{
+	printf ("modspectre-rec - read modspectre.lv2 spectrogram recordings\n\n"
+	        "Usage: modspectre-rec [ OPTIONS ] <file.msr>\n\n"
+	        "Options:\n"
+	        "  -b          binary output: per record sr_record head, followed\n"
+	        "              by n_traces * n_cols float values\n"
+	        "  -e <time>   end of the range (default 0)\n"
+	        "  -h          print this message\n"
+	        "  -l <level>  0: every frame, 1, 2, 3: max of 2, 4, 16 frames\n"
+	        "              (default: finest level that covers the range)\n"
+	        "  -n <rows>   max. number of records, use a coarser level if needed\n"
+	        "  -s <time>   dump records starting at <time>\n"
+	        "  -t <trace>  only dump the given trace (default: all)\n"
+	        "\n"
+	        "Without -s, a summary of the recording is printed.\n"
+	        "Times are UNIX time in seconds, or seconds relative to the\n"
+	        "most recent record if <= 0; e.g. -s -300 -e -240 is the minute\n"
+	        "starting 5 minutes ago.\n"
+	        "\n"
+	        "CSV output has one line per record: time, frame, frames combined\n"
+	        "in the record, followed by values 0..1 (-96..0dB) for every column\n"
+	        "of every trace. The first line lists column frequencies.\n");
+}
+
+int
+main (int argc, char** argv)
+{
+	const char* t_start = NULL;
+	const char* t_end   = NULL;
+	int         level   = -1;
+	int         trace   = -1;
+	uint64_t    max_n   = 0;
+	bool        binary  = false;
+
+	int c;
+	while ((c = getopt (argc, argv, "be:hl:n:s:t:")) != -1) {
+		switch (c) {
+			case 'b':
+				binary = true;
+				break;
+			case 'e':
+				t_end = optarg;
+				break;
+			case 'h':
+				usage ();
+				return 0;
+			case 'l':
+				level = atoi (optarg);
+				if (level < 0 || level >= SR_LEVELS) {
+					fprintf (stderr, "Invalid level\n");
+					return 1;
+				}
+				break;
+			case 'n':
+				max_n = atoi (optarg);
+				break;
+			case 's':
+				t_start = optarg;
+				break;
+			case 't':
+				trace = atoi (optarg);
+				break;
+			default:
+				usage ();
+				return 1;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage ();
+		return 1;
+	}
+
+	sr_file* f = sr_open (argv[optind]);
+	if (!f) {
+		fprintf (stderr, "Cannot open recording '%s'\n", argv[optind]);
+		return 1;
+	}
+
+	float* data = (float*)malloc (f->h->n_max * sizeof (float));
+	if (!data) {
+		sr_close (f);
+		return 1;
+	}
+
+	if (!t_start) {
+		info (f, data);
+		free (data);
+		sr_close (f);
+		return 0;
+	}
+
+	int64_t t0, t1;
+	if (!level_span (f, 0, &t0, &t1, data)) {
+		fprintf (stderr, "Recording is empty\n");
+		free (data);
+		sr_close (f);
+		return 1;
+	}
+
+	const int64_t ts = parse_time (t_start, t1);
+	const int64_t te = t_end ? parse_time (t_end, t1) : t1;
+
+	/* finest level that covers the start, with at most max_n records */
+	if (level < 0) {
+		for (level = 0; level < SR_LEVELS - 1; ++level) {
+			int64_t lt0, lt1;
+			if (!level_span (f, level, &lt0, &lt1, data) || lt0 > ts) {
+				continue;
+			}
+			const uint64_t i0 = sr_find (f, level, ts);
+			const uint64_t i1 = sr_find (f, level, te + 1);
+			if (max_n == 0 || i1 - i0 <= max_n) {
+				break;
+			}
+		}
+	}
+
+	const uint64_t i0 = sr_find (f, level, ts);
+	const uint64_t i1 = sr_find (f, level, te + 1);
+	uint32_t       n_cols = 0;
+	uint32_t       n_hdr  = 0;
+
+	if (!binary) {
+		fprintf (stderr, "# level %d, %" PRIu64 " records\n", level, i1 - i0);
+	}
+
+	for (uint64_t i = i0; i < i1 && (max_n == 0 || i - i0 < max_n); ++i) {
+		sr_record r;
+		if (sr_read (f, level, i, &r, data)) {
+			continue; // overwritten
+		}
+		uint32_t t_first = 0;
+		uint32_t n_tr    = r.n_traces;
+		if (trace >= 0) {
+			if (trace >= r.n_traces) {
+				continue;
+			}
+			t_first = trace;
+			n_tr    = 1;
+		}
+		float const* v = &data[t_first * r.n_cols];
+
+		if (binary) {
+			r.n_traces = n_tr;
+			fwrite (&r, sizeof (sr_record), 1, stdout);
+			fwrite (v, sizeof (float), n_tr * r.n_cols, stdout);
+			continue;
+		}
+
+		if (r.n_cols != n_cols || n_tr != n_hdr) {
+			n_cols = r.n_cols;
+			n_hdr  = n_tr;
+			printf ("time,frame,n_frames");
+			for (uint32_t t = 0; t < n_tr; ++t) {
+				for (uint32_t k = 0; k < n_cols; ++k) {
+					printf (",%.1f", freq_at_col (n_cols, k));
+				}
+			}
+			printf ("\n");
+		}
+
+		printf ("%.3f,%u,%u", r.time_ns * 1e-9, r.frame, r.n_frames);
+		for (uint32_t k = 0; k < n_tr * r.n_cols; ++k) {
+			printf (",%.4f", v[k]);
+		}
+		printf ("\n");
+	}
+
+	free (data);
+	sr_close (f);
+	return 0;
+}
@@ -0,0 +1,317 @@
+/* modspectre.lv2 - shared memory export reader
+ *
+ * Copyright (C) 2017 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* List, watch or dump the spectra that plugin instances publish when
+ * the host runs with X42_MODSPECTRE_SHM=1. This is also an example
+ * how to use shmexport.h from other applications.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmexport.h"
+
+#define SHM_DIR "/dev/shm"
+
+static volatile bool run = true;
+
+static void
+catchsig (int sig)
+{
+	run = false;
+}
+
+static uint64_t
+now_ns (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool
+pid_alive (int pid)
+{
+	return pid > 0 && (kill (pid, 0) == 0 || errno == EPERM);
+}
+
+static const char*
+engine (mss_frame const* f)
+{
+	static char buf[32];
+	if (f->fft_size == 0) {
+		return "CQT";
+	}
+	snprintf (buf, sizeof (buf), "FFT %u", f->fft_size);
+	return buf;
+}
+
+/* retry while the writer is busy, returns 0 on success */
+static int
+read_frame (mss_segment const* s, mss_frame* f, float* data)
+{
+	int rv;
+	for (int i = 0; i < 1000; ++i) {
+		if ((rv = mss_read (s, f, data, s->n_max)) <= 0) {
+			return rv;
+		}
+		sched_yield ();
+	}
+	return 1;
+}
+
+static int
+list (bool clean)
+{
+	DIR* dir = opendir (SHM_DIR);
+	if (!dir) {
+		fprintf (stderr, "Cannot list " SHM_DIR "\n");
+		return 1;
+	}
+	const size_t   pl  = strlen (MSS_PREFIX) - 1; // w/o leading slash
+	const uint64_t now = now_ns ();
+
+	struct dirent* de;
+	while ((de = readdir (dir))) {
+		if (strncmp (de->d_name, MSS_PREFIX + 1, pl)) {
+			continue;
+		}
+		mss_segment const* s = mss_open (de->d_name);
+		if (!s) {
+			printf ("%-28s invalid\n", de->d_name);
+			continue;
+		}
+		const bool alive = pid_alive (s->pid);
+		if (!alive && clean) {
+			char path[300];
+			snprintf (path, sizeof (path), "/%s", de->d_name);
+			mss_close (s);
+			if (shm_unlink (path)) {
+				fprintf (stderr, "Cannot remove %s\n", de->d_name);
+			} else {
+				printf ("%-28s removed\n", de->d_name);
+			}
+			continue;
+		}
+
+		mss_frame f;
+		float*    data = (float*)malloc (s->n_max * sizeof (float));
+		if (!alive) {
+			printf ("%-28s pid %d is gone\n", de->d_name, s->pid);
+		} else if (!data || read_frame (s, &f, data)) {
+			printf ("%-28s pid %d, %uch, no data\n", de->d_name, s->pid, s->n_channels);
+		} else {
+			printf ("%-28s pid %d, %uch, %s @ %.0fHz, %u x %u, frame %" PRIu64 " (%.1fs ago)\n",
+			        de->d_name, s->pid, s->n_channels,
+			        engine (&f), f.rate,
+			        f.n_traces, f.n_cols, f.frame, (now - f.time_ns) * 1e-9);
+		}
+		free (data);
+		mss_close (s);
+	}
+	closedir (dir);
+	return 0;
+}
+
+/* print the peak of every trace, once per interval */
+static int
+watch (mss_segment const* s, double interval)
+{
+	float*   data  = (float*)malloc (s->n_max * sizeof (float));
+	uint64_t frame = 0;
+	uint64_t t0    = 0;
+
+	while (run) {
+		mss_frame f;
+		if (read_frame (s, &f, data)) {
+			usleep (interval * 1e6);
+			continue;
+		}
+		if (!pid_alive (s->pid)) {
+			fprintf (stderr, "Writer (pid %d) is gone\n", s->pid);
+			break;
+		}
+		if (frame > 0 && f.frame > frame && f.time_ns > t0) {
+			printf ("frame %8" PRIu64 " %5.1f fps |", f.frame, (f.frame - frame) * 1e9 / (f.time_ns - t0));
+		} else {
+			printf ("frame %8" PRIu64 "   -   fps |", f.frame);
+		}
+		/* correlation traces are last */
+		const uint32_t n_pairs = f.flags & MSS_CORRELATION ? s->n_channels / 2 : 0;
+		for (uint32_t t = 0; t < f.n_traces; ++t) {
+			float const* tr = &data[t * f.n_cols];
+			if (t + n_pairs >= f.n_traces) {
+				/* average correlation of all columns with signal */
+				float    sum = 0;
+				uint32_t n   = 0;
+				for (uint32_t c = 1; c < f.n_cols; ++c) {
+					if (tr[c] > 0) {
+						sum += 2.f * tr[c] - 1.f;
+						++n;
+					}
+				}
+				printf (" corr %+5.2f", n > 0 ? sum / n : 0.f);
+				continue;
+			}
+			uint32_t pk = 0;
+			for (uint32_t c = 1; c < f.n_cols; ++c) {
+				if (tr[c] > tr[pk]) {
+					pk = c;
+				}
+			}
+			printf (" %6.0fHz %5.1fdB", mss_freq_at_col (f.n_cols, pk), (tr[pk] - 1.f) * 96.f);
+		}
+		printf ("\n");
+		fflush (stdout);
+		frame = f.frame;
+		t0    = f.time_ns;
+		usleep (interval * 1e6);
+	}
+	free (data);
+	return 0;
+}
+
+/* CSV: column center frequency, followed by one value per trace */
+static int
+dump (mss_segment const* s)
+{
+	float*    data = (float*)malloc (s->n_max * sizeof (float));
+	mss_frame f;
+	if (!data || read_frame (s, &f, data)) {
+		fprintf (stderr, "No frame available\n");
+		free (data);
+		return 1;
+	}
+	printf ("# frame %" PRIu64 ", %s @ %.0fHz, %u traces, 0..1 = -96..0dB\n",
+	        f.frame, engine (&f), f.rate, f.n_traces);
+	for (uint32_t c = 0; c < f.n_cols; ++c) {
+		printf ("%.2f", mss_freq_at_col (f.n_cols, c));
+		for (uint32_t t = 0; t < f.n_traces; ++t) {
+			printf (",%.5f", data[t * f.n_cols + c]);
+		}
+		printf ("\n");
+	}
+	free (data);
+	return 0;
+}
+
+static void
+usage (void)
+{
+	printf ("modspectre-shm - read modspectre.lv2 shared memory export\n\n"
+	        "Usage: modspectre-shm [ OPTIONS ] [ segment ]\n\n"
+	        "Options:\n"
+	        "  -c          remove segments of processes that are gone\n"
+	        "  -d          dump the most recent frame of the given segment as CSV\n"
+	        "  -h          print this message\n"
+	        "  -i <sec>    watch interval (default 0.5)\n"
+	        "  -w          watch the given segment, print the peak of every trace\n"
+	        "\n"
+	        "The export is enabled by running the plugin host with\n"
+	        "X42_MODSPECTRE_SHM=1. Every plugin instance creates a segment\n"
+	        "x42-modspectre-<pid>-<n>. Without a segment name all segments\n"
+	        "in " SHM_DIR " are listed.\n"
+	        "\n"
+	        "Traces are channels, [mid, side] and [correlation] per channel\n"
+	        "pair, in that order. Values are 0..1 for -96..0dB, correlation\n"
+	        "0..1 for -1..+1.\n");
+}
+
+int
+main (int argc, char** argv)
+{
+	bool   clean    = false;
+	bool   do_dump  = false;
+	bool   do_watch = false;
+	double interval = .5;
+
+	int c;
+	while ((c = getopt (argc, argv, "cdhi:w")) != -1) {
+		switch (c) {
+			case 'c':
+				clean = true;
+				break;
+			case 'd':
+				do_dump = true;
+				break;
+			case 'h':
+				usage ();
+				return 0;
+			case 'i':
+				interval = atof (optarg);
+				if (interval < .01) {
+					interval = .01;
+				}
+				break;
+			case 'w':
+				do_watch = true;
+				break;
+			default:
+				usage ();
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		return list (clean);
+	}
+
+	mss_segment const* s = mss_open (argv[optind]);
+	if (!s) {
+		fprintf (stderr, "Cannot open segment '%s'\n", argv[optind]);
+		return 1;
+	}
+
+	int rv = 0;
+	if (do_watch) {
+		signal (SIGINT, catchsig);
+		signal (SIGTERM, catchsig);
+		rv = watch (s, interval);
+	} else if (do_dump) {
+		rv = dump (s);
+	} else {
+		mss_frame f;
+		float*    data = (float*)malloc (s->n_max * sizeof (float));
+		printf ("pid:      %d%s\n", s->pid, pid_alive (s->pid) ? "" : " (gone)");
+		printf ("channels: %u\n", s->n_channels);
+		printf ("capacity: %u\n", s->n_max);
+		if (data && 0 == read_frame (s, &f, data)) {
+			printf ("frame:    %" PRIu64 "\n", f.frame);
+			printf ("age:      %.3fs\n", (now_ns () - f.time_ns) * 1e-9);
+			printf ("engine:   %s\n", engine (&f));
+			printf ("rate:     %.0fHz\n", f.rate);
+			printf ("traces:   %u x %u columns\n", f.n_traces, f.n_cols);
+		}
+		free (data);
+	}
+	mss_close (s);
+	return rv;
+}